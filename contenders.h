@@ -3,6 +3,11 @@
 
 #include "naive.h"
 #include "rplus.h"
+#include "rplus_autotune.h"
+#include "rplus_concurrent.h"
+#include "rplus_numa.h"
+#include "remote_shard.h"
+#include "sharded.h"
 
 #elif defined ADD_CONTENDERS
 
@@ -15,6 +20,32 @@ experiments.addContender("R+Tree128", []() { return new RPlusTree<Point, 128>; }
 experiments.addContender("R+Tree256", []() { return new RPlusTree<Point, 256>; });
 experiments.addContender("R+Tree512", []() { return new RPlusTree<Point, 512>; });
 experiments.addContender("R+Tree1024", []() { return new RPlusTree<Point, 1024>; });
+experiments.addContender("R+TreeL8F32", []() { return new RPlusTree<Point, 8, 32>; });
+experiments.addContender("R+TreeL8F128", []() { return new RPlusTree<Point, 8, 128>; });
+experiments.addContender("R+TreeL8F512", []() { return new RPlusTree<Point, 8, 512>; });
+experiments.addContender("R+TreeL16F64", []() { return new RPlusTree<Point, 16, 64>; });
+experiments.addContender("R+TreeL16F256", []() { return new RPlusTree<Point, 16, 256>; });
+experiments.addContender("R+TreeL32F128", []() { return new RPlusTree<Point, 32, 128>; });
+experiments.addContender("R+TreeL32F512", []() { return new RPlusTree<Point, 32, 512>; });
+experiments.addContender("R+TreeL64F16", []() { return new RPlusTree<Point, 64, 16>; });
+experiments.addContender("R+TreeHP64", []() {
+    NodePlacement placement;
+    placement.huge_pages = true;
+    return new RPlusTree<Point, 64>(placement);
+});
+experiments.addContender("R+TreeNUMA64", []() { return new ReplicatedRPlusTree<Point, 64>; });
+experiments.addContender("R+TreeW64", []() { return new RPlusTree<Point, 64, 64, Weight>; });
+experiments.addContender("R+TreeAuto", []() { return new AutoTunedRPlusTree<Point>; });
+experiments.addContender("R+TreeMVCC64", []() { return new ConcurrentRPlusTree<Point, 64>; });
+experiments.addContender("Sharded4", []() {
+    return new ShardedRangeSearch<Point>(4, []() { return new RPlusTree<Point, 64>; });
+});
+experiments.addContender("Sharded16", []() {
+    return new ShardedRangeSearch<Point>(16, []() { return new RPlusTree<Point, 64>; });
+});
+experiments.addContender("ShardedIPC4", []() {
+    return new ShardedRangeSearch<Point>(4, []() { return new RemoteShard<Point, RPlusTree<Point, 64>>; });
+});
 
 #endif
 
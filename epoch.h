@@ -0,0 +1,120 @@
+// vim: tabstop=2 shiftwidth=2 expandtab
+
+#ifndef RANGE_SEARCH_EPOCH_H_
+#define RANGE_SEARCH_EPOCH_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace range_search {
+
+
+// Epoch-based reclamation of objects that readers may still be using after a writer unlinked them.
+// Readers pin the current epoch for as long as they access shared objects. The writer retires
+// unlinked objects tagged with the epoch they were retired in and advances the epoch; an object is
+// freed once no reader is pinned to its epoch or an earlier one, since readers pinned later can no
+// longer reach it.
+//
+// Any number of threads may pin concurrently (up to kSlots pins at a time), Retire must only be
+// called by one thread at a time.
+template<class T>
+class EpochReclaimer {
+
+  public:
+  static const size_t kSlots = 128;
+
+  // Keeps an epoch pinned until destroyed.
+  class Guard {
+    public:
+    Guard(Guard&& other) : slot_(other.slot_) { other.slot_ = nullptr; }
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+    ~Guard() {
+      if (slot_) {
+        slot_->store(0, std::memory_order_release);
+      }
+    }
+
+    private:
+    friend class EpochReclaimer;
+    explicit Guard(std::atomic<uint64_t>* slot) : slot_(slot) { }
+
+    std::atomic<uint64_t>* slot_;
+  };
+
+  explicit EpochReclaimer(void (*free)(T*)) : free_(free), epoch_(1), slots_() { }
+
+  // Frees all retired objects; no thread may be pinned.
+  ~EpochReclaimer() {
+    for (auto& r : retired_) {
+      free_(r.second);
+    }
+  }
+
+  EpochReclaimer(const EpochReclaimer&) = delete;
+  EpochReclaimer& operator=(const EpochReclaimer&) = delete;
+
+  // Pin the current epoch. Objects reachable from shared pointers loaded afterwards stay valid
+  // until the guard is destroyed.
+  Guard Pin() {
+    // Start at a slot depending on the thread to keep threads from contending for the same one.
+    static thread_local const size_t start = std::hash<std::thread::id>()(std::this_thread::get_id());
+    const uint64_t epoch = epoch_.load();
+    for (size_t i = 0; i < kSlots; ++i) {
+      std::atomic<uint64_t>& slot = slots_[(start + i) % kSlots].epoch;
+      uint64_t expected = 0;
+      // Sequentially consistent: a writer that does not see this pin has published its new version
+      // before our subsequent loads.
+      if (slot.load(std::memory_order_relaxed) == 0 && slot.compare_exchange_strong(expected, epoch)) {
+        return Guard(&slot);
+      }
+    }
+    throw std::runtime_error("Too many concurrent epoch pins");
+  }
+
+  // Retire objects the writer has just unlinked from the shared structure and free those retired
+  // earlier that no reader can reach anymore.
+  void Retire(const std::vector<T*>& objects) {
+    const uint64_t epoch = epoch_.fetch_add(1);
+    for (T* object : objects) {
+      retired_.emplace_back(epoch, object);
+    }
+
+    uint64_t oldest = epoch + 1;
+    for (auto& slot : slots_) {
+      const uint64_t pinned = slot.epoch.load();
+      if (pinned != 0 && pinned < oldest) {
+        oldest = pinned;
+      }
+    }
+    // retired_ is ordered by epoch.
+    size_t freed = 0;
+    while (freed < retired_.size() && retired_[freed].first < oldest) {
+      free_(retired_[freed++].second);
+    }
+    retired_.erase(retired_.begin(), retired_.begin() + freed);
+  }
+
+  // Number of objects retired but not yet freed.
+  size_t pending() const { return retired_.size(); }
+
+  private:
+  // Padded to a cache line so that pinning threads do not share lines.
+  struct Slot {
+    std::atomic<uint64_t> epoch;
+    char padding[64 - sizeof(std::atomic<uint64_t>)];
+  };
+
+  void (*free_)(T*);
+  std::atomic<uint64_t> epoch_;
+  Slot slots_[kSlots];
+  std::vector<std::pair<uint64_t, T*>> retired_;
+};
+
+}  // namespace range_search
+#endif  // RANGE_SEARCH_EPOCH_H_
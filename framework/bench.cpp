@@ -1,13 +1,19 @@
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <limits>
+
 #include "../contenders.h"
 #include "../range_search.h"
 #include "command_line_options.h"
+#include "cpu_settings.h"
 #include "benchmark.h"
 #include "experiments.h"
 #include "generator.h"
 #include "instrumentation.h"
+#include "instrumentation_perf.h"
 #ifdef MALLOC_INSTR
 #include "instrumentation_malloc.h"
 #endif
@@ -33,14 +39,69 @@ std::vector<RandomBenchmark> randomBenchmarks() {
     };
 }
 
-std::unique_ptr<Benchmark<RangeSearch>> make_benchmark(const RandomBenchmark& b,
-        size_t n, size_t q, bool reporting) {
+using Window = std::pair<Point, Point>;
+
+// Generates the queries for a benchmark, unless they are replayed from a file.
+Records<Window> make_queries(const Records<Point>& points, double min, double max,
+        const Records<Window>& trace, const CommandLineOptions& options, std::string& params) {
+    if (!trace.empty()) {
+        params += "\tworkload=file";
+        return trace;
+    }
+    const size_t q = options.num_queries;
+    const auto workload = static_cast<Generator::Workload>(options.workload);
+    params += std::string("\tworkload=") + CommandLineOptions::workloadNames[options.workload];
+    if (workload == Generator::Workload::kRandom)
+        return Generator::generateRectangles(q, min, max, q);
+    params += "\tselectivity=" + std::to_string(options.selectivity)
+        + "\taspect=" + std::to_string(options.aspect);
+    return Generator::generateWindows(q, points.begin(), points.end(), workload,
+            options.selectivity / 100, options.aspect, q);
+}
+
+// Runs the queries as selected by -g, -k, -r and -S; aggregate queries get random weights.
+std::unique_ptr<Benchmark<RangeSearch>> make_query_benchmark(Records<Point> points,
+        Records<Window> queries, const CommandLineOptions& options, const std::string& params) {
+    if (options.aggregate_query) {
+        auto weights = Generator::generateWeights(points.size(), points.size());
+        return std::unique_ptr<Benchmark<RangeSearch>>(new AggregateQueries<Point>{
+            std::move(points), std::move(weights), std::move(queries), params
+        });
+    }
     return std::unique_ptr<Benchmark<RangeSearch>>(new RangeSearchQueries<Point>{
-        Generator::generatePoints(n, b.distribution, n),
-        Generator::generateRectangles(q, b.min, b.max, q),
-        reporting, "\tbench=" + b.name
+        std::move(points), std::move(queries), static_cast<bool>(options.reporting_query),
+        static_cast<QueryShape>(options.shape), static_cast<size_t>(options.batch), params
     });
 }
+
+std::unique_ptr<Benchmark<RangeSearch>> make_benchmark(const RandomBenchmark& b,
+        size_t n, const Records<Window>& trace, const CommandLineOptions& options) {
+    Records<Point> points = Generator::generatePoints(n, b.distribution, n);
+    std::string params = "\tbench=" + b.name;
+    auto queries = make_queries(points, b.min, b.max, trace, options, params);
+    return make_query_benchmark(std::move(points), std::move(queries), options, params);
+}
+
+std::unique_ptr<Benchmark<RangeSearch>> make_benchmark(const std::string& name,
+        const Records<Point>& points, const Records<Window>& trace,
+        const CommandLineOptions& options) {
+    double min = std::numeric_limits<double>::max();
+    double max = std::numeric_limits<double>::lowest();
+    for (const auto& p : points)
+        for (auto coordinate : p) {
+            min = std::min(min, coordinate);
+            max = std::max(max, coordinate);
+        }
+    std::string params = "\tbench=" + name;
+    auto queries = make_queries(points, min, max, trace, options, params);
+    return make_query_benchmark(points, std::move(queries), options, params);
+}
+
+// Benchmark name for a file: its base name without extension.
+std::string file_benchmark_name(const std::string& path) {
+    auto name = path.substr(path.find_last_of('/') + 1);
+    return name.substr(0, name.find('.'));
+}
 } // namespace
 
 int main(int argc, char* argv[]) {
@@ -48,15 +109,43 @@ int main(int argc, char* argv[]) {
     if (options.has_invalid_option)
         return -1;
 
+    if (options.pin_cpu >= 0) {
+        try {
+            pinToCpu(options.pin_cpu);
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+            return -1;
+        }
+    }
+#ifndef MALLOC_INSTR
+    checkCpuFrequency(std::max(options.pin_cpu, 0));
+#endif
+
     Experiments<RangeSearch> experiments("results/");
 
-    const auto addBenchmarks = [&experiments, &options](size_t num) {
+    Records<Point> points;
+    Records<Window> trace;
+    try {
+        if (!options.points_file.empty())
+            points = Records<Point>::map(options.points_file, kPointsMagic, 1);
+        if (!options.queries_file.empty())
+            trace = Records<Window>::map(options.queries_file, kQueriesMagic, 2);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    const auto addBenchmarks = [&experiments, &options, &trace](size_t num) {
         for (auto& b : randomBenchmarks())
             if (options.hasBenchmark(b.name))
                 experiments.addBenchmark(b.name + " (n=" + std::to_string(num) + ')',
-                        make_benchmark(b, num, options.num_queries, options.reporting_query));
+                        make_benchmark(b, num, trace, options));
     };
-    if (options.set_size)
+    if (!options.points_file.empty()) {
+        const auto name = file_benchmark_name(options.points_file);
+        experiments.addBenchmark(name + " (n=" + std::to_string(points.size()) + ')',
+                make_benchmark(name, points, trace, options));
+    } else if (options.set_size)
         addBenchmarks(options.set_size);
     else for (size_t num = 32, exp = 5;
             exp <= static_cast<size_t>(options.max_exponent); num *= 2, exp++)
@@ -66,9 +155,62 @@ int main(int argc, char* argv[]) {
     if (options.hasInstrumentation("time"))
         experiments.addInstrumentation("time",
                 std::unique_ptr<Instrumentation>(new TimeInstrumentation()));
-    if (options.hasInstrumentation("papi"))
-        experiments.addInstrumentation("papi",
-                std::unique_ptr<Instrumentation>(new DefaultPapiInstrumentation()));
+    // without PAPI, "papi" falls back to the same events read through perf
+    if (options.hasInstrumentation("papi")) {
+        try {
+#ifdef HAVE_PAPI
+            using PapiBackend = PapiInstrumentation;
+            using DefaultPapiBackend = DefaultPapiInstrumentation;
+#else
+            using PapiBackend = PerfInstrumentation;
+            using DefaultPapiBackend = DefaultPerfInstrumentation;
+#endif
+            experiments.addInstrumentation("papi", std::unique_ptr<Instrumentation>(
+                        options.papi_events.empty() ? new DefaultPapiBackend()
+                        : new PapiBackend(PapiBackend::parseEvents(options.papi_events))));
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << "; skipping hardware counters" << std::endl;
+        }
+    }
+    if (options.hasInstrumentation("perf")) {
+        try {
+            experiments.addInstrumentation("perf", std::unique_ptr<Instrumentation>(
+                        options.perf_events.empty() ? new DefaultPerfInstrumentation()
+                        : new PerfInstrumentation(PerfInstrumentation::parseEvents(options.perf_events))));
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << "; skipping perf counters" << std::endl;
+        }
+    }
+    if (options.hasInstrumentation("latency"))
+        experiments.addInstrumentation("latency",
+                std::unique_ptr<Instrumentation>(new LatencyInstrumentation()));
+    if (options.hasInstrumentation("traversal")) {
+#ifdef RANGE_SEARCH_TRAVERSAL_STATS
+        experiments.addInstrumentation("traversal",
+                std::unique_ptr<Instrumentation>(new TraversalInstrumentation()));
+#else
+        if (options.instrumentations)
+            std::cerr << "Traversal statistics are not compiled in; "
+                "rebuild with 'make TRAVERSAL_STATS=1'" << std::endl;
+#endif
+    }
+    if (options.hasInstrumentation("phases")) {
+        std::unique_ptr<CounterInstrumentation> counters;
+        try {
+#ifdef HAVE_PAPI
+            counters.reset(new DefaultPapiInstrumentation());
+#else
+            counters.reset(new DefaultPerfInstrumentation());
+#endif
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << "; profiling phases without hardware counters" << std::endl;
+        }
+        experiments.addInstrumentation("phases",
+                std::unique_ptr<Instrumentation>(new PhaseInstrumentation(std::move(counters))));
+    }
+    if (options.hasInstrumentation("structure"))
+        experiments.addInstrumentation("structure",
+                std::unique_ptr<Instrumentation>(new StructureInstrumentation()));
 #else
     if (options.hasInstrumentation("memory"))
         experiments.addInstrumentation("memory",
@@ -89,7 +231,23 @@ int main(int argc, char* argv[]) {
         }
     }
 
-    experiments.run(options.iterations, options.append_results);
+    Repetitions repetitions;
+    repetitions.warmup = options.warmup;
+    repetitions.min = options.iterations;
+    repetitions.max = options.ci > 0
+        ? std::max(options.iterations, options.max_iterations) : options.iterations;
+    repetitions.ci = options.ci / 100;
+    experiments.run(repetitions, options.append_results);
+
+    // regressions found before re-executing (see below) are passed on in the
+    // environment, so that the final exit status covers all instrumentations
+    const char* const regressed_env = "RANGE_SEARCH_REGRESSED";
+    bool regressed = getenv(regressed_env) != nullptr;
+    if (!options.baseline_dir.empty()
+            && experiments.compareToBaseline(options.baseline_dir, options.threshold / 100)) {
+        regressed = true;
+        setenv(regressed_env, "1", 1);
+    }
 
     char** args = nullptr;
 #ifndef MALLOC_INSTR
@@ -97,10 +255,20 @@ int main(int argc, char* argv[]) {
         auto alt_options = options;
         alt_options.removeInstrumentation("time");
         alt_options.removeInstrumentation("papi");
+        alt_options.removeInstrumentation("perf");
+        alt_options.removeInstrumentation("latency");
+        alt_options.removeInstrumentation("traversal");
+        alt_options.removeInstrumentation("phases");
+        alt_options.removeInstrumentation("structure");
         args = alt_options.makeCommandLine("./bench_malloc");
     }
 #else
-    if (options.hasInstrumentation("time") || options.hasInstrumentation("papi")) {
+    if (options.hasInstrumentation("time") || options.hasInstrumentation("papi")
+            || options.hasInstrumentation("perf")
+            || options.hasInstrumentation("latency")
+            || options.hasInstrumentation("traversal")
+            || options.hasInstrumentation("phases")
+            || options.hasInstrumentation("structure")) {
         auto alt_options = options;
         alt_options.removeInstrumentation("memory");
         args = alt_options.makeCommandLine("./bench");
@@ -114,6 +282,11 @@ int main(int argc, char* argv[]) {
         return -3;
     }
 
+    if (regressed) {
+        std::cerr << "\nPerformance regressed compared to baseline " << options.baseline_dir
+            << std::endl;
+        return -4;
+    }
     return 0;
 }
 
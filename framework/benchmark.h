@@ -2,10 +2,13 @@
 #define FRAMEWORK_BENCHMARK_H_
 
 #include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <ostream>
 
 #include "../range_search.h"
+#include "binary_file.h"
+#include "instrumentation.h"
 
 namespace framework {
 
@@ -16,32 +19,76 @@ class Benchmark {
 
     virtual void runPreprocessing(Datastructure&) = 0;
     virtual void runQueries(Datastructure&) = 0;
+    virtual void runQueries(Datastructure&, QueryTimer&) = 0;
     virtual bool compare(Datastructure& lhs, Datastructure& rhs) = 0;
     virtual std::ostream& result(std::ostream&) const = 0;
 };
 
+/// Query shapes derived from the query windows, see RangeSearchQueries.
+enum class QueryShape {
+    /// The window itself.
+    kRectangle,
+    /// The largest circle centred in the window.
+    kCircle,
+    /// The hexagon inscribed in the window's inscribed ellipse.
+    kPolygon
+};
+
 template<class Point>
 class RangeSearchQueries : public Benchmark<range_search::RangeSearch<Point>> {
  public:
-    RangeSearchQueries(std::vector<Point> dataset,
-            std::vector<std::pair<Point, Point>> queries,
+    /// The dataset and queries may be owned vectors or memory-mapped files.
+    /// Circles and polygons are always reported, regardless of reporting_query.
+    /// With a batch size, rectangle queries are passed to countRanges or
+    /// reportRanges in batches of that size, which data structures may run
+    /// interleaved; the latency instrumentation then times whole batches.
+    RangeSearchQueries(Records<Point> dataset,
+            Records<std::pair<Point, Point>> queries,
             bool reporting_query = false,
+            QueryShape shape = QueryShape::kRectangle,
+            size_t batch_size = 0,
             std::string params = "")
         : dataset_(std::move(dataset))
         , queries_(std::move(queries))
         , params_(std::move(params))
-        , reporting_query_(reporting_query)
+        , reporting_query_(reporting_query || shape != QueryShape::kRectangle)
+        , shape_(shape)
+        , batch_size_(shape == QueryShape::kRectangle ? batch_size : 0)
+        , batch_results_(batch_size_)
+        , batch_counts_(batch_size_)
     {
-        if (reporting_query_)
+        if (reporting_query_ && !batch_size_)
             result_.reserve(dataset_.size());
+        for (const auto& q : queries_) {
+            const Point centre{{(q.first[0] + q.second[0]) / 2, (q.first[1] + q.second[1]) / 2}};
+            const double rx = (q.second[0] - q.first[0]) / 2, ry = (q.second[1] - q.first[1]) / 2;
+            if (shape_ == QueryShape::kCircle)
+                circles_.emplace_back(centre, std::min(rx, ry));
+            if (shape_ == QueryShape::kPolygon) {
+                std::vector<Point> hexagon;
+                for (int i = 0; i < 6; ++i) {
+                    const double angle = M_PI / 3 * i;
+                    hexagon.push_back({{centre[0] + rx * std::cos(angle), centre[1] + ry * std::sin(angle)}});
+                }
+                polygons_.push_back(std::move(hexagon));
+            }
+        }
     }
 
     void runPreprocessing(range_search::RangeSearch<Point>& rs) override {
-        rs.assign(dataset_);
+        rs.assign(dataset_.begin(), dataset_.end());
     }
 
     void runQueries(range_search::RangeSearch<Point>& rs) override {
-        if (reporting_query_)
+        if (batch_size_)
+            for (size_t first = 0; first < queries_.size(); first += batch_size_)
+                runBatch(rs, first);
+        else if (shape_ != QueryShape::kRectangle)
+            for (size_t i = 0; i < queries_.size(); ++i) {
+                reportShape(rs, i, result_);
+                result_.clear();
+            }
+        else if (reporting_query_)
             for (const auto& q : queries_) {
                 rs.reportRange(q.first, q.second, result_);
                 result_.clear();
@@ -50,25 +97,68 @@ class RangeSearchQueries : public Benchmark<range_search::RangeSearch<Point>> {
             rs.countRange(q.first, q.second);
     }
 
+    void runQueries(range_search::RangeSearch<Point>& rs, QueryTimer& timer) override {
+        if (batch_size_)
+            for (size_t first = 0; first < queries_.size(); first += batch_size_) {
+                timer.startQuery();
+                runBatch(rs, first);
+                timer.stopQuery();
+            }
+        else if (shape_ != QueryShape::kRectangle)
+            for (size_t i = 0; i < queries_.size(); ++i) {
+                timer.startQuery();
+                reportShape(rs, i, result_);
+                timer.stopQuery();
+                result_.clear();
+            }
+        else if (reporting_query_)
+            for (const auto& q : queries_) {
+                timer.startQuery();
+                rs.reportRange(q.first, q.second, result_);
+                timer.stopQuery();
+                result_.clear();
+            }
+        else for (const auto& q : queries_) {
+            timer.startQuery();
+            rs.countRange(q.first, q.second);
+            timer.stopQuery();
+        }
+    }
+
     std::ostream& result(std::ostream& str) const override {
         return str << "\tsize=" << dataset_.size()
             << "\tqueries=" << queries_.size()
             << "\treporting=" << reporting_query_
+            << "\tshape=" << shapeName()
+            << "\tbatch=" << batch_size_
             << params_;
     }
 
+    /// With a batch size, rhs answers the queries in batches, both reporting
+    /// and counting.
     bool compare(range_search::RangeSearch<Point>& lhs, range_search::RangeSearch<Point>& rhs) override {
         bool mismatch = false;
-        std::vector<Point> result2;
+        const size_t batch = std::max<size_t>(batch_size_, 1);
+        std::vector<std::vector<Point>> results(batch);
+        std::vector<size_t> counts(batch);
         std::vector<Point> diff;
-        for (const auto& q : queries_) {
-            lhs.reportRange(q.first, q.second, result_);
-            rhs.reportRange(q.first, q.second, result2);
+        for (size_t first = 0; first < queries_.size(); first += batch) {
+            const size_t num = std::min(batch, queries_.size() - first);
+            if (batch_size_) {
+                rhs.reportRanges(queries_.begin() + first, num, results.data());
+                rhs.countRanges(queries_.begin() + first, num, counts.data());
+            } else
+                reportShape(rhs, first, results[0]);
+            for (size_t j = 0; j < num; ++j) {
+            const auto& q = queries_[first + j];
+            auto& result2 = results[j];
+            reportShape(lhs, first + j, result_);
             std::sort(result_.begin(), result_.end());
             std::sort(result2.begin(), result2.end());
-            if (result_ != result2) {
+            if (result_ != result2 || (batch_size_ && counts[j] != result_.size())) {
                 mismatch = true;
-                std::cerr << "Mismatch in query [(" << q.first[0] << ',' << q.first[1]
+                std::cerr << "Mismatch in " << shapeName() << " query in [("
+                    << q.first[0] << ',' << q.first[1]
                     << "), (" << q.second[0] << ',' << q.second[1] << ")]";
 
                 std::cerr << "\nExpected:";
@@ -80,20 +170,64 @@ class RangeSearchQueries : public Benchmark<range_search::RangeSearch<Point>> {
                 std::set_difference(result2.begin(), result2.end(), result_.begin(),
                         result_.end(), std::back_inserter(diff));
                 printPoints(diff);
+                if (batch_size_)
+                    std::cerr << "\nCounted: " << counts[j] << " of " << result_.size();
                 std::cerr << std::endl;
             }
             result_.clear();
             result2.clear();
+            }
         }
         return mismatch;
     }
 
  private:
-    std::vector<Point> dataset_;
-    std::vector<std::pair<Point, Point>> queries_;
+    Records<Point> dataset_;
+    Records<std::pair<Point, Point>> queries_;
     std::string params_;
     std::vector<Point> result_;
     bool reporting_query_;
+    QueryShape shape_;
+    size_t batch_size_;
+    std::vector<std::vector<Point>> batch_results_;
+    std::vector<size_t> batch_counts_;
+
+    /// Runs the batch of queries starting at first.
+    void runBatch(range_search::RangeSearch<Point>& rs, size_t first) {
+        const size_t num = std::min(batch_size_, queries_.size() - first);
+        if (reporting_query_) {
+            rs.reportRanges(queries_.begin() + first, num, batch_results_.data());
+            for (size_t i = 0; i < num; ++i)
+                batch_results_[i].clear();
+        } else
+            rs.countRanges(queries_.begin() + first, num, batch_counts_.data());
+    }
+    /// Centre and radius, or vertices, of the i-th query's shape.
+    std::vector<std::pair<Point, double>> circles_;
+    std::vector<std::vector<Point>> polygons_;
+
+    /// Reports the points in the shape of the i-th query.
+    void reportShape(range_search::RangeSearch<Point>& rs, size_t i, std::vector<Point>& result) {
+        switch (shape_) {
+        case QueryShape::kRectangle:
+            rs.reportRange(queries_[i].first, queries_[i].second, result);
+            break;
+        case QueryShape::kCircle:
+            rs.reportCircle(circles_[i].first, circles_[i].second, result);
+            break;
+        case QueryShape::kPolygon:
+            rs.reportPolygon(polygons_[i], result);
+            break;
+        }
+    }
+
+    const char* shapeName() const {
+        switch (shape_) {
+        case QueryShape::kCircle: return "circle";
+        case QueryShape::kPolygon: return "polygon";
+        default: return "rectangle";
+        }
+    }
 
     static void printPoints(std::vector<Point>& points) {
         const size_t size = points.size();
@@ -106,6 +240,79 @@ class RangeSearchQueries : public Benchmark<range_search::RangeSearch<Point>> {
     }
 };
 
+/// Aggregates (count, sum, minimum and maximum) of the points' weights over
+/// the query windows. Needs contenders that support weighted points.
+template<class Point>
+class AggregateQueries : public Benchmark<range_search::RangeSearch<Point>> {
+ public:
+    /// weights[i] belongs to the i-th point of the dataset.
+    AggregateQueries(Records<Point> dataset,
+            std::vector<double> weights,
+            Records<std::pair<Point, Point>> queries,
+            std::string params = "")
+        : dataset_(std::move(dataset))
+        , weights_(std::move(weights))
+        , queries_(std::move(queries))
+        , params_(std::move(params))
+    {}
+
+    void runPreprocessing(range_search::RangeSearch<Point>& rs) override {
+        rs.assignWeighted(dataset_.begin(), dataset_.end(), weights_.data());
+    }
+
+    void runQueries(range_search::RangeSearch<Point>& rs) override {
+        for (const auto& q : queries_)
+            rs.aggregateRange(q.first, q.second);
+    }
+
+    void runQueries(range_search::RangeSearch<Point>& rs, QueryTimer& timer) override {
+        for (const auto& q : queries_) {
+            timer.startQuery();
+            rs.aggregateRange(q.first, q.second);
+            timer.stopQuery();
+        }
+    }
+
+    std::ostream& result(std::ostream& str) const override {
+        return str << "\tsize=" << dataset_.size()
+            << "\tqueries=" << queries_.size()
+            << "\taggregate=1"
+            << params_;
+    }
+
+    /// Sums may differ in rounding, depending on the order of the additions.
+    bool compare(range_search::RangeSearch<Point>& lhs, range_search::RangeSearch<Point>& rhs) override {
+        bool mismatch = false;
+        for (const auto& q : queries_) {
+            const auto expected = lhs.aggregateRange(q.first, q.second);
+            const auto got = rhs.aggregateRange(q.first, q.second);
+            if (expected.count != got.count || expected.min != got.min || expected.max != got.max
+                    || std::abs(expected.sum - got.sum) > 1e-9 * expected.count) {
+                mismatch = true;
+                std::cerr << "Mismatch in query [(" << q.first[0] << ',' << q.first[1]
+                    << "), (" << q.second[0] << ',' << q.second[1] << ")]"
+                    << "\nExpected: ";
+                print(expected);
+                std::cerr << "\nGot:      ";
+                print(got);
+                std::cerr << std::endl;
+            }
+        }
+        return mismatch;
+    }
+
+ private:
+    Records<Point> dataset_;
+    std::vector<double> weights_;
+    Records<std::pair<Point, Point>> queries_;
+    std::string params_;
+
+    static void print(const range_search::Aggregate& a) {
+        std::cerr << "count " << a.count << ", sum " << a.sum << ", min " << a.min
+            << ", max " << a.max;
+    }
+};
+
 }  // namespace framework
 #endif  // FRAMEWORK_BENCHMARK_H_
 
@@ -0,0 +1,40 @@
+#include "binary_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace framework {
+
+MappedFile::MappedFile(const std::string& path) : data_(nullptr), size_(0) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Failed to open " + path + ": " + strerror(errno));
+    struct stat st;
+    if (fstat(fd, &st)) {
+        const int err = errno;
+        close(fd);
+        throw std::runtime_error("Failed to stat " + path + ": " + strerror(err));
+    }
+    size_ = st.st_size;
+    if (size_) {
+        data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (data_ == MAP_FAILED) {
+            const int err = errno;
+            close(fd);
+            throw std::runtime_error("Failed to map " + path + ": " + strerror(err));
+        }
+        madvise(data_, size_, MADV_SEQUENTIAL);
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (size_)
+        munmap(data_, size_);
+}
+
+}  // namespace framework
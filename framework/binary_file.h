@@ -0,0 +1,100 @@
+#ifndef FRAMEWORK_BINARY_FILE_H_
+#define FRAMEWORK_BINARY_FILE_H_
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace framework {
+
+/// Binary points and query files consist of this header followed by `count`
+/// records of `dimensions` (points) or 2 * `dimensions` (query windows, lower
+/// corner first) doubles in native byte order. See tools/csv2bin.cpp.
+struct BinaryFileHeader {
+    char magic[8];
+    uint32_t dimensions;
+    uint32_t scalar_size;
+    uint64_t count;
+};
+static_assert(sizeof(BinaryFileHeader) == 24, "BinaryFileHeader must not be padded");
+
+constexpr char kPointsMagic[8] = "RSPNTS1";
+constexpr char kQueriesMagic[8] = "RSQRYS1";
+
+/// Read-only memory mapping of a whole file.
+class MappedFile {
+ public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return static_cast<const char*>(data_); }
+    size_t size() const { return size_; }
+
+ private:
+    void* data_;
+    size_t size_;
+};
+
+/// Contiguous, immutable array of records that are either owned or live in a
+/// memory-mapped file. Copies share the underlying storage.
+template<class Record>
+class Records {
+ public:
+    Records() : begin_(nullptr), end_(nullptr) {}
+
+    Records(std::vector<Record> records) {
+        auto storage = std::make_shared<std::vector<Record>>(std::move(records));
+        begin_ = storage->data();
+        end_ = begin_ + storage->size();
+        owner_ = std::move(storage);
+    }
+
+    /// Maps the records of a binary file written by tools/csv2bin. Each record
+    /// consists of `corners` points, i.e. 1 for points and 2 for query windows.
+    static Records map(const std::string& path, const char (&magic)[8], size_t corners) {
+        // std::pair is not trivially copyable, but has the layout of a plain struct
+        static_assert(std::is_standard_layout<Record>::value
+                && std::is_trivially_destructible<Record>::value,
+                "Records must be plain structs of doubles");
+
+        auto file = std::make_shared<MappedFile>(path);
+        BinaryFileHeader header;
+        if (file->size() < sizeof(header))
+            throw std::runtime_error(path + ": file too short");
+        std::memcpy(&header, file->data(), sizeof(header));
+        if (std::memcmp(header.magic, magic, sizeof(header.magic)))
+            throw std::runtime_error(path + ": not a " + magic + " file");
+        if (header.scalar_size != sizeof(double)
+                || sizeof(Record) != corners * header.dimensions * sizeof(double))
+            throw std::runtime_error(path + ": unsupported number of dimensions or scalar type");
+        // Divide rather than multiply, so that a corrupt count cannot wrap around.
+        if (header.count > (file->size() - sizeof(header)) / sizeof(Record))
+            throw std::runtime_error(path + ": file truncated");
+
+        Records result;
+        result.begin_ = reinterpret_cast<const Record*>(file->data() + sizeof(header));
+        result.end_ = result.begin_ + header.count;
+        result.owner_ = std::move(file);
+        return result;
+    }
+
+    const Record* begin() const { return begin_; }
+    const Record* end() const { return end_; }
+    size_t size() const { return end_ - begin_; }
+    bool empty() const { return begin_ == end_; }
+    const Record& operator[](size_t i) const { return begin_[i]; }
+
+ private:
+    const Record* begin_;
+    const Record* end_;
+    std::shared_ptr<const void> owner_;
+};
+
+}  // namespace framework
+#endif  // FRAMEWORK_BINARY_FILE_H_
@@ -2,6 +2,7 @@
 
 #include <getopt.h>
 #include <string.h>
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
 #include <type_traits>
@@ -10,6 +11,8 @@ namespace framework {
 
 constexpr decltype(CommandLineOptions::benchmarkNames) CommandLineOptions::benchmarkNames;
 constexpr decltype(CommandLineOptions::instrumentationNames) CommandLineOptions::instrumentationNames;
+constexpr decltype(CommandLineOptions::workloadNames) CommandLineOptions::workloadNames;
+constexpr decltype(CommandLineOptions::shapeNames) CommandLineOptions::shapeNames;
 
 namespace {
 bool setBitset(const char* arg, int& bs, const char* const* names, int count) {
@@ -34,18 +37,62 @@ void CommandLineOptions::printUsage(const char* program_name) {
     std::cerr << "Usage: " << program_name << " <options>..."
         "\n  -h, --help                    print this message"
         "\n  -a, --append                  append results instead of overwriting"
+        "\n  -B, --baseline <dir>          compare results to those of an earlier run"
+        "\n                                  stored in dir, and fail if a metric"
+        "\n                                  regressed significantly. Needs -i 2 or"
+        "\n                                  more. See also -T."
         "\n  -b, --benchmark <name>        benchmark(s) to run. Default is all."
         "\n                                  Valid arguments: uniform, skewed,"
         "\n                                  normal, clustered, stacked"
         "\n  -c, --compare                 compare query results before benchmarking"
         "\n  -e, --max-exponent <n>        generate benchmarks with up to 2^n points."
         "\n                                  Default is 22. See also -n."
+        "\n  -f, --points-file <file>      benchmark the points of a binary file instead of"
+        "\n                                  generated ones (see csv2bin). Ignores -b, -e, -n."
+        "\n  -g, --aggregate-query         aggregate (count, sum, minimum, maximum) random"
+        "\n                                  weights of the points in each window instead"
+        "\n                                  of counting them. Overrides -r. Contenders"
+        "\n                                  without weighted points are skipped."
+        "\n  -C, --ci <percent>            repeat experiments until the 95% confidence"
+        "\n                                  interval of each median is within this"
+        "\n                                  percentage of it (at least -i and 8, at"
+        "\n                                  most -I iterations). Default is off."
         "\n  -i, --iterations <n>          set number of iterations of experiments"
+        "\n  -I, --max-iterations <n>      limit iterations with -C. Default is 100."
+        "\n  -k, --batch <n>               pass rectangle queries to the data structures in"
+        "\n                                  batches of n, which they may interleave."
+        "\n                                  latency then times whole batches. Default is off."
         "\n  -m, --instrumentation <name>  instrumentations to use (default is all)"
-        "\n                                  valid arguments: time, papi, memory"
+        "\n                                  valid arguments: time, papi, memory,"
+        "\n                                  latency, traversal (requires building"
+        "\n                                  with TRAVERSAL_STATS=1), phases,"
+        "\n                                  structure, perf (papi falls back to perf"
+        "\n                                  when built without PAPI). papi and perf"
+        "\n                                  take an optional event list, e.g."
+        "\n                                  papi:L2_DCM,TLB_DM or perf:dTLB-load-misses"
         "\n  -n, --num-points <n>          set number of points in generated data sets"
+        "\n  -p, --pin <cpu>               pin the benchmark to the given CPU"
         "\n  -q, --num-queries <n>         set number of queries to run. Default is 10000."
+        "\n  -Q, --queries-file <file>     run the query windows of a binary file instead of"
+        "\n                                  generated ones (see csv2bin). Ignores -q, -s, -w, -x."
         "\n  -r, --reporting-query         do range reporting query. Default is counting."
+        "\n  -S, --shape <name>            query shape inside each window. Default is rectangle."
+        "\n                                  rectangle: the window itself"
+        "\n                                  circle: largest circle centred in the window"
+        "\n                                  polygon: hexagon inscribed in the window"
+        "\n                                  Circles and polygons are always reported."
+        "\n  -s, --selectivity <percent>   fraction of points each query window should"
+        "\n                                  contain. Default is 0.1. See also -w."
+        "\n  -w, --workload <name>         how to place query windows. Default is random."
+        "\n                                  random: two uniformly distributed corners"
+        "\n                                  selectivity: uniformly distributed centre"
+        "\n                                  data: centred on a data point"
+        "\n                                  zipf: Zipf-distributed hot spots"
+        "\n                                  All but random honour -s and -x."
+        "\n  -T, --threshold <percent>     minimum slowdown counted as regression by -B."
+        "\n                                  Default is 5."
+        "\n  -W, --warmup <n>              discard n iterations before measuring"
+        "\n  -x, --aspect <ratio>          ratio of window width to height. Default is 1."
         << std::endl;
 }
 
@@ -54,20 +101,34 @@ CommandLineOptions CommandLineOptions::parse(int argc, char* const argv[]) {
     ::option options[] = {
         { "help", no_argument, nullptr, 'h' },
         { "append", no_argument, &o.append_results, 1},
+        { "baseline", required_argument, nullptr, 'B' },
         { "benchmark", required_argument, nullptr, 'b' },
+        { "ci", required_argument, nullptr, 'C' },
         { "compare", no_argument, nullptr, 'c' },
+        { "batch", required_argument, nullptr, 'k' },
         { "iterations", required_argument, nullptr, 'i' },
+        { "max-iterations", required_argument, nullptr, 'I' },
         { "instrumentation", required_argument, nullptr, 'm' },
         { "max-exponent", required_argument, nullptr, 'e' },
         { "num-points", required_argument, nullptr, 'n' },
         { "num-queries", required_argument, nullptr, 'q' },
+        { "pin", required_argument, nullptr, 'p' },
+        { "points-file", required_argument, nullptr, 'f' },
+        { "queries-file", required_argument, nullptr, 'Q' },
         { "reporting-query", no_argument, &o.reporting_query, 1},
+        { "aggregate-query", no_argument, &o.aggregate_query, 1},
+        { "selectivity", required_argument, nullptr, 's' },
+        { "shape", required_argument, nullptr, 'S' },
+        { "threshold", required_argument, nullptr, 'T' },
+        { "warmup", required_argument, nullptr, 'W' },
+        { "workload", required_argument, nullptr, 'w' },
+        { "aspect", required_argument, nullptr, 'x' },
         { 0, 0, 0, 0 }
     };
 
     opterr = 0;
     int c;
-    while ((c = getopt_long(argc, argv, ":ab:ce:hi:m:n:q:r", options, nullptr)) != -1) {
+    while ((c = getopt_long(argc, argv, ":ab:B:cC:e:f:ghi:I:k:m:n:p:q:Q:rs:S:T:w:W:x:", options, nullptr)) != -1) {
         switch (c) {
         case 0: break;
         case 'a':
@@ -80,9 +141,19 @@ CommandLineOptions CommandLineOptions::parse(int argc, char* const argv[]) {
                 o.has_invalid_option = true;
             }
             break;
+        case 'B':
+            o.baseline_dir = optarg;
+            break;
         case 'c':
             o.compare = 1;
             break;
+        case 'C':
+            o.ci = std::atof(optarg);
+            if (o.ci <= 0) {
+                std::cerr << "Invalid argument to '-C': Must be > 0" << std::endl;
+                o.has_invalid_option = true;
+            }
+            break;
         case 'e':
             o.max_exponent = std::atoi(optarg);
             if (o.max_exponent <= 4) {
@@ -90,6 +161,12 @@ CommandLineOptions CommandLineOptions::parse(int argc, char* const argv[]) {
                 o.has_invalid_option = true;
             }
             break;
+        case 'f':
+            o.points_file = optarg;
+            break;
+        case 'g':
+            o.aggregate_query = 1;
+            break;
         case 'h':
             o.has_invalid_option = true;
             break;
@@ -100,13 +177,41 @@ CommandLineOptions CommandLineOptions::parse(int argc, char* const argv[]) {
                 o.has_invalid_option = true;
             }
             break;
-        case 'm':
-            if (!setBitset(optarg, o.instrumentations, instrumentationNames,
-                        std::extent<decltype(instrumentationNames)>::value)) {
+        case 'I':
+            o.max_iterations = std::atoi(optarg);
+            if (o.max_iterations <= 0) {
+                std::cerr << "Invalid argument to '-I': Must be > 0" << std::endl;
+                o.has_invalid_option = true;
+            }
+            break;
+        case 'k':
+            o.batch = std::atoi(optarg);
+            if (o.batch <= 0) {
+                std::cerr << "Invalid argument to '-k': Must be > 0" << std::endl;
+                o.has_invalid_option = true;
+            }
+            break;
+        case 'm': {
+            // hardware counter instrumentations take an optional list of events
+            std::string name = optarg, events;
+            const auto colon = name.find(':');
+            if (colon != std::string::npos) {
+                events = name.substr(colon + 1);
+                name.resize(colon);
+            }
+            if (!setBitset(name.c_str(), o.instrumentations, instrumentationNames,
+                        std::extent<decltype(instrumentationNames)>::value)
+                    || (colon != std::string::npos
+                        && (events.empty() || (name != "papi" && name != "perf")))) {
                 std::cerr << "Invalid argument to '-m': " << optarg << std::endl;
                 o.has_invalid_option = true;
+            } else if (name == "papi") {
+                o.papi_events = events;
+            } else if (name == "perf") {
+                o.perf_events = events;
             }
             break;
+        }
         case 'n':
             o.set_size = std::atol(optarg);
             if (o.set_size <= 0) {
@@ -114,6 +219,13 @@ CommandLineOptions CommandLineOptions::parse(int argc, char* const argv[]) {
                 o.has_invalid_option = true;
             }
             break;
+        case 'p':
+            o.pin_cpu = std::atoi(optarg);
+            if (o.pin_cpu < 0) {
+                std::cerr << "Invalid argument to '-p': Must be >= 0" << std::endl;
+                o.has_invalid_option = true;
+            }
+            break;
         case 'q':
             o.num_queries = std::atoi(optarg);
             if (o.num_queries <= 0) {
@@ -121,9 +233,60 @@ CommandLineOptions CommandLineOptions::parse(int argc, char* const argv[]) {
                 o.has_invalid_option = true;
             }
             break;
+        case 'Q':
+            o.queries_file = optarg;
+            break;
         case 'r':
             o.reporting_query = 1;
             break;
+        case 's':
+            o.selectivity = std::atof(optarg);
+            if (o.selectivity <= 0 || o.selectivity > 100) {
+                std::cerr << "Invalid argument to '-s': Must be in (0, 100]" << std::endl;
+                o.has_invalid_option = true;
+            }
+            break;
+        case 'w': {
+            const auto count = std::extent<decltype(workloadNames)>::value;
+            o.workload = std::find_if(workloadNames, workloadNames + count,
+                    [](const char* name) { return !strcmp(name, optarg); }) - workloadNames;
+            if (static_cast<size_t>(o.workload) == count) {
+                std::cerr << "Invalid argument to '-w': " << optarg << std::endl;
+                o.has_invalid_option = true;
+            }
+            break;
+        }
+        case 'S': {
+            const auto count = std::extent<decltype(shapeNames)>::value;
+            o.shape = std::find_if(shapeNames, shapeNames + count,
+                    [](const char* name) { return !strcmp(name, optarg); }) - shapeNames;
+            if (static_cast<size_t>(o.shape) == count) {
+                std::cerr << "Invalid argument to '-S': " << optarg << std::endl;
+                o.has_invalid_option = true;
+            }
+            break;
+        }
+        case 'T':
+            o.threshold = std::atof(optarg);
+            if (o.threshold < 0) {
+                std::cerr << "Invalid argument to '-T': Must be >= 0" << std::endl;
+                o.has_invalid_option = true;
+            }
+            break;
+        case 'W':
+            o.warmup = std::atoi(optarg);
+            if (o.warmup < 0) {
+                std::cerr << "Invalid argument to '-W': Must be >= 0" << std::endl;
+                o.has_invalid_option = true;
+            }
+            break;
+        case 'x':
+            o.aspect = std::atof(optarg);
+            if (o.aspect <= 0) {
+                std::cerr << "Invalid argument to '-x': Must be > 0" << std::endl;
+                o.has_invalid_option = true;
+            }
+            break;
         case ':':
             o.has_invalid_option = true;
             if (optopt)
@@ -141,6 +304,11 @@ CommandLineOptions CommandLineOptions::parse(int argc, char* const argv[]) {
         }
     }
 
+    if (!o.baseline_dir.empty() && o.iterations < 2) {
+        std::cerr << "'-B' needs at least 2 iterations ('-i 2') to test for significance" << std::endl;
+        o.has_invalid_option = true;
+    }
+
     if (o.has_invalid_option)
         printUsage(argv[0]);
     return o;
@@ -170,8 +338,9 @@ void CommandLineOptions::removeInstrumentation(const std::string& name) {
 }
 
 char** CommandLineOptions::makeCommandLine(const char* program_name) const {
-    char** argv = new char*[32];
-    argv[0] = new char[1024];
+    char** argv = new char*[64];
+    argv[0] = new char[1024 + points_file.size() + queries_file.size()
+        + papi_events.size() + perf_events.size() + baseline_dir.size()];
     char* p = argv[0];
     int argc = 0;
     const auto add = [&](const char* opt) {
@@ -182,7 +351,11 @@ char** CommandLineOptions::makeCommandLine(const char* program_name) const {
     };
     const auto addN = [&](size_t n) {
         argv[argc++] = p;
-        p += sprintf(p, "%tu", n);
+        p += sprintf(p, "%tu", n) + 1;
+    };
+    const auto addF = [&](double f) {
+        argv[argc++] = p;
+        p += sprintf(p, "%.17g", f) + 1;
     };
     add(program_name);
 
@@ -195,8 +368,13 @@ char** CommandLineOptions::makeCommandLine(const char* program_name) const {
     if (instrumentations)
         for (size_t i = 0; i < std::extent<decltype(instrumentationNames)>::value; ++i)
             if (instrumentations & (1 << i)) {
+                std::string name = instrumentationNames[i];
+                if (name == "papi" && !papi_events.empty())
+                    name += ':' + papi_events;
+                else if (name == "perf" && !perf_events.empty())
+                    name += ':' + perf_events;
                 add("-m");
-                add(instrumentationNames[i]);
+                add(name.c_str());
             }
     add("-e");
     addN(max_exponent);
@@ -208,8 +386,54 @@ char** CommandLineOptions::makeCommandLine(const char* program_name) const {
     addN(num_queries);
     add("-i");
     addN(iterations);
+    if (warmup) {
+        add("-W");
+        addN(warmup);
+    }
+    if (ci > 0) {
+        add("-C");
+        addF(ci);
+        add("-I");
+        addN(max_iterations);
+    }
+    if (pin_cpu >= 0) {
+        add("-p");
+        addN(pin_cpu);
+    }
     if (reporting_query)
         add("-r");
+    if (aggregate_query)
+        add("-g");
+    if (batch) {
+        add("-k");
+        addN(batch);
+    }
+    if (shape) {
+        add("-S");
+        add(shapeNames[shape]);
+    }
+    if (!points_file.empty()) {
+        add("-f");
+        add(points_file.c_str());
+    }
+    if (!queries_file.empty()) {
+        add("-Q");
+        add(queries_file.c_str());
+    }
+    if (workload) {
+        add("-w");
+        add(workloadNames[workload]);
+        add("-s");
+        addF(selectivity);
+        add("-x");
+        addF(aspect);
+    }
+    if (!baseline_dir.empty()) {
+        add("-B");
+        add(baseline_dir.c_str());
+        add("-T");
+        addF(threshold);
+    }
     if (append_results)
         add("-a");
     // never compare, already did that this run if requested
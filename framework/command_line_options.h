@@ -14,15 +14,39 @@ struct CommandLineOptions {
     long set_size = 0;
     int num_queries = 10000;
     int iterations = 1;
+    int warmup = 0;
+    int max_iterations = 100;
+    double ci = 0;
+    int pin_cpu = -1;
+    std::string baseline_dir;
+    double threshold = 5;
     int reporting_query = 0;
+    int aggregate_query = 0;
     int append_results = 0;
     int compare = 0;
+    int workload = 0;
+    int shape = 0;
+    int batch = 0;
+    double selectivity = 0.1;
+    double aspect = 1.0;
+    std::string points_file;
+    std::string queries_file;
+    std::string papi_events;
+    std::string perf_events;
 
     static constexpr const char* const benchmarkNames[] = {
         "uniform", "skewed", "normal", "clustered", "stacked"
     };
+    static constexpr const char* const workloadNames[] = {
+        "random", "selectivity", "data", "zipf"
+    };
+    /// In the order of QueryShape.
+    static constexpr const char* const shapeNames[] = {
+        "rectangle", "circle", "polygon"
+    };
     static constexpr const char* const instrumentationNames[] = {
-        "time", "papi", "memory"
+        "time", "papi", "memory", "latency", "traversal",
+        "phases", "structure", "perf"
     };
 
     bool hasBenchmark(const std::string& name) const;
@@ -0,0 +1,46 @@
+#include "cpu_settings.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+namespace framework {
+
+namespace {
+bool readSetting(const std::string& path, std::string& value) {
+    std::ifstream file(path);
+    return static_cast<bool>(file >> value);
+}
+}  // namespace
+
+void pinToCpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set))
+        throw std::runtime_error("Failed to pin to CPU " + std::to_string(cpu) + ": "
+                + strerror(errno));
+}
+
+bool checkCpuFrequency(int cpu) {
+    bool stable = true;
+    std::string value;
+    const auto cpufreq = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cpufreq/";
+    if (readSetting(cpufreq + "scaling_governor", value) && value != "performance") {
+        std::cerr << "Warning: CPU " << cpu << " uses the '" << value
+            << "' frequency governor, timings may be noisy" << std::endl;
+        stable = false;
+    }
+    if ((readSetting("/sys/devices/system/cpu/intel_pstate/no_turbo", value) && value == "0")
+            || (readSetting("/sys/devices/system/cpu/cpufreq/boost", value) && value == "1")) {
+        std::cerr << "Warning: turbo boost is enabled, timings may be noisy" << std::endl;
+        stable = false;
+    }
+    return stable;
+}
+
+}  // namespace framework
@@ -0,0 +1,16 @@
+#ifndef FRAMEWORK_CPU_SETTINGS_H_
+#define FRAMEWORK_CPU_SETTINGS_H_
+
+namespace framework {
+
+/// Pins the calling thread to the given CPU. Throws std::runtime_error on failure.
+void pinToCpu(int cpu);
+
+/// Warns on stderr about CPU settings that make timings noisy: a frequency
+/// scaling governor other than "performance" and enabled turbo boost. Settings
+/// that cannot be read (e.g. in virtual machines) are not reported. Returns
+/// whether the settings look stable.
+bool checkCpuFrequency(int cpu);
+
+}  // namespace framework
+#endif  // FRAMEWORK_CPU_SETTINGS_H_
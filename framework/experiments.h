@@ -1,18 +1,36 @@
 #ifndef FRAMEWORK_EXPERIMENTS_H_
 #define FRAMEWORK_EXPERIMENTS_H_
 
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
 #include <functional>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <sstream>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
 #include "benchmark.h"
 #include "instrumentation.h"
+#include "statistics.h"
 
 namespace framework {
 
+/// How often to repeat each experiment, see Experiments::run.
+struct Repetitions {
+    size_t warmup = 0;
+    size_t min = 1;
+    size_t max = 1;
+    /// Target half width of the confidence interval relative to the median;
+    /// 0 to run exactly `min` iterations.
+    double ci = 0;
+};
+
 template<class Datastructure>
 class Experiments {
  public:
@@ -31,42 +49,151 @@ class Experiments {
         benchmarks_.push_back({name, std::move(benchmark)});
     }
 
+    /// Runs each experiment `iterations` times and writes the raw results.
     void run(size_t iterations = 1, bool append_results = false, bool quiet = false) {
+        Repetitions repetitions;
+        repetitions.min = repetitions.max = iterations;
+        run(repetitions, append_results, quiet);
+    }
+
+    /// Runs each experiment after discarding `warmup` iterations, at least
+    /// `min` times and until the confidence interval of the median of every
+    /// result column is within `ci` of the median, or `max` iterations.
+    /// Besides the raw results, writes median, MAD and confidence interval of
+    /// each column to <prefix><instrumentation>_summary.txt.
+    void run(const Repetitions& repetitions, bool append_results = false, bool quiet = false) {
         const std::fstream::openmode openmode = append_results
             ? std::fstream::out | std::fstream::app
             : std::fstream::out;
         for (const auto& instr : instrumentation_) {
             std::ofstream results(file_prefix_ + instr.name + ".txt", openmode);
+            std::ofstream summary(file_prefix_ + instr.name + "_summary.txt", openmode);
+            summary.precision(std::numeric_limits<double>::digits10);
             for (const auto& contender : contenders_) {
                 for (const auto& benchmark : benchmarks_) {
                     std::cout << "\nBenchmarking " << contender.name;
                     std::cout << " using " << instr.name << " instrumentation on "
                         << benchmark.name << std::endl;
-                    for (size_t i = 0; i < iterations; ++i) {
+                    bool supported = true;
+                    for (size_t i = 0; supported && i < repetitions.warmup; ++i) {
+                        std::ostringstream discard;
+                        supported = runIteration(contender, benchmark, instr, discard, true);
+                    }
+
+                    std::vector<Column> columns;
+                    size_t i = 0;
+                    while (supported && i < repetitions.max
+                            && (i < repetitions.min || !converged(columns, repetitions.ci))) {
+                        std::ostringstream line;
+                        if (!(supported = runIteration(contender, benchmark, instr, line, quiet)))
+                            break;
                         results << "RESULT\tds=" << contender.name;
                         benchmark.benchmark->result(results);
+                        results << line.str() << std::endl;
+                        addSamples(line.str(), columns);
+                        ++i;
+                    }
+                    if (!supported)
+                        continue;
+                    if (repetitions.ci > 0)
+                        std::cout << (converged(columns, repetitions.ci) ? "Converged" : "Did not converge")
+                            << " after " << i << " iterations" << std::endl;
 
-                        if (!quiet) std::cout << "Preprocessing:\n";
-                        instr.instr->start();
-                        std::unique_ptr<Datastructure> ds(contender.factory());
-                        benchmark.benchmark->runPreprocessing(*ds);
-                        instr.instr->stop();
-                        instr.instr->result(results, "\tpre");
-                        if (!quiet) instr.instr->print(std::cout);
-
-                        if (!quiet) std::cout << "Queries:\n";
-                        instr.instr->start();
-                        benchmark.benchmark->runQueries(*ds);
-                        instr.instr->stop();
-                        instr.instr->result(results);
-                        if (!quiet) instr.instr->print(std::cout);
-                        results << std::endl;
+                    summary << "RESULT\tds=" << contender.name;
+                    benchmark.benchmark->result(summary);
+                    summary << "\titerations=" << i;
+                    for (const auto& column : columns) {
+                        const auto s = summarize(column.samples);
+                        summary << '\t' << column.name << '=' << s.median
+                            << '\t' << column.name << "_mad=" << s.mad
+                            << '\t' << column.name << "_cilo=" << s.ci_low
+                            << '\t' << column.name << "_cihi=" << s.ci_high;
                     }
+                    summary << std::endl;
                 }
             }
         }
     }
 
+    /// Compares the results of the last run to those in `baseline_dir` (same
+    /// file names), grouped by contender and benchmark. A metric regressed if
+    /// its mean increased by more than `threshold` (relative) and Welch's
+    /// t-test rejects equal means at the 5% level. The test needs at least two
+    /// iterations on both sides; with fewer, a metric regressed if its mean
+    /// increased by more than `threshold` alone, with a warning. Returns
+    /// whether any metric regressed.
+    bool compareToBaseline(const std::string& baseline_dir, double threshold) const {
+        bool regressed = false, warned = false;
+        for (const auto& instr : instrumentation_) {
+            const auto file = instr.name + ".txt";
+            std::ifstream baseline(baseline_dir + '/' + file), current(file_prefix_ + file);
+            if (!baseline) {
+                std::cerr << "No baseline for " << instr.name << " instrumentation in "
+                    << baseline_dir << std::endl;
+                continue;
+            }
+            std::vector<std::string> baseline_lines, current_lines;
+            for (std::string line; std::getline(baseline, line); )
+                baseline_lines.push_back(line);
+            for (std::string line; std::getline(current, line); )
+                current_lines.push_back(line);
+
+            for (const auto& contender : contenders_) {
+                for (const auto& benchmark : benchmarks_) {
+                    std::ostringstream key;
+                    key << "RESULT\tds=" << contender.name;
+                    benchmark.benchmark->result(key);
+                    std::vector<Column> before, after;
+                    for (const auto& line : baseline_lines)
+                        if (hasKey(line, key.str()))
+                            addSamples(line.substr(key.str().size()), before);
+                    for (const auto& line : current_lines)
+                        if (hasKey(line, key.str()))
+                            addSamples(line.substr(key.str().size()), after);
+                    if (before.empty() || after.empty())
+                        continue;
+
+                    std::cout << "\n" << contender.name << " on " << benchmark.name
+                        << " (" << instr.name << ", " << before.front().samples.size()
+                        << " vs. " << after.front().samples.size() << " iterations):" << std::endl;
+                    for (const auto& column : after) {
+                        const auto base = std::find_if(before.begin(), before.end(),
+                                [&column](const Column& c) { return c.name == column.name; });
+                        if (base == before.end())
+                            continue;
+                        const double old_mean = mean(base->samples), new_mean = mean(column.samples);
+                        const double change = old_mean == 0 ? 0 : new_mean / old_mean - 1;
+                        const double p = welchTTest(base->samples, column.samples);
+                        const bool tested = !std::isnan(p);
+                        const bool significant = tested ? p < 0.05 : true;
+                        const bool regression = instr.instr->measuresCost() && significant
+                            && change > threshold;
+                        if (!tested && !warned) {
+                            std::cerr << "Warning: fewer than 2 iterations in " << baseline_dir
+                                << " or in this run, counting every change beyond the threshold"
+                                " as regression" << std::endl;
+                            warned = true;
+                        }
+                        regressed |= regression;
+                        std::cout << "  " << column.name << ": " << old_mean << " -> " << new_mean
+                            << " (" << std::showpos << std::fixed << std::setprecision(1)
+                            << change * 100 << '%' << std::noshowpos << std::defaultfloat
+                            << std::setprecision(6);
+                        if (!tested)
+                            std::cout << ", not tested";
+                        else
+                            std::cout << ", p=" << p;
+                        const char* verdict = regression ? " REGRESSION"
+                            : !significant || change == 0 ? ""
+                            : instr.instr->measuresCost() && change < 0 ? " improved" : " changed";
+                        std::cout << ')' << verdict << std::endl;
+                    }
+                }
+            }
+        }
+        return regressed;
+    }
+
     bool compare() const {
         if (contenders_.size() < 2) {
             std::cerr << "At least 2 contenders must be registered." << std::endl;
@@ -76,14 +203,15 @@ class Experiments {
         for (const auto& benchmark : benchmarks_) {
             std::cout << "\nComparing query results on benchmark " << benchmark.name
                 << " using " << contenders_.front().name << " as base" << std::endl;
-            std::unique_ptr<Datastructure> base(contenders_.front().factory());
-            benchmark.benchmark->runPreprocessing(*base);
+            const auto base = preprocess(contenders_.front(), benchmark);
+            if (!base)
+                continue;
 
             for (size_t i = 1; i < contenders_.size(); ++i) {
                 std::cout << "Comparing to " << contenders_[i].name << std::endl;
-                std::unique_ptr<Datastructure> ds(contenders_[i].factory());
-                benchmark.benchmark->runPreprocessing(*ds);
-                mismatch |= benchmark.benchmark->compare(*base, *ds);
+                const auto ds = preprocess(contenders_[i], benchmark);
+                if (ds)
+                    mismatch |= benchmark.benchmark->compare(*base, *ds);
             }
         }
         return mismatch;
@@ -102,6 +230,79 @@ class Experiments {
         std::string name;
         std::unique_ptr<Benchmark<Datastructure>> benchmark;
     };
+    struct Column {
+        std::string name;
+        std::vector<double> samples;
+    };
+
+    /// Creates the contender and runs the benchmark's preprocessing on it.
+    /// Returns null, with a note, if the contender lacks an optional operation
+    /// the benchmark needs, i.e. it throws std::logic_error (see RangeSearch).
+    static std::unique_ptr<Datastructure> preprocess(const Contender& contender,
+            const NamedBenchmark& benchmark) {
+        std::unique_ptr<Datastructure> ds(contender.factory());
+        try {
+            benchmark.benchmark->runPreprocessing(*ds);
+        } catch (const std::logic_error& e) {
+            std::cout << "Skipping " << contender.name << ": " << e.what() << std::endl;
+            ds.reset();
+        }
+        return ds;
+    }
+
+    /// Writes the result columns of one iteration to `results`. Returns false
+    /// if the contender does not support the benchmark.
+    static bool runIteration(const Contender& contender, const NamedBenchmark& benchmark,
+            const NamedInstr& instr, std::ostream& results, bool quiet) {
+        if (!quiet) std::cout << "Preprocessing:\n";
+        instr.instr->start();
+        const auto ds = preprocess(contender, benchmark);
+        instr.instr->stop();
+        if (!ds)
+            return false;
+        instr.instr->inspect([&ds]() { return ds->metrics(); });
+        instr.instr->result(results, "\tpre");
+        if (!quiet) instr.instr->print(std::cout);
+
+        if (!quiet) std::cout << "Queries:\n";
+        instr.instr->start();
+        if (auto timer = instr.instr->queryTimer())
+            benchmark.benchmark->runQueries(*ds, *timer);
+        else
+            benchmark.benchmark->runQueries(*ds);
+        instr.instr->stop();
+        instr.instr->result(results);
+        if (!quiet) instr.instr->print(std::cout);
+        return true;
+    }
+
+    /// Parses the tab-separated key=value pairs of a result line.
+    static void addSamples(const std::string& line, std::vector<Column>& columns) {
+        std::istringstream fields(line);
+        std::string field;
+        while (std::getline(fields, field, '\t')) {
+            const auto eq = field.find('=');
+            if (eq == std::string::npos) continue;
+            const auto name = field.substr(0, eq);
+            auto column = std::find_if(columns.begin(), columns.end(),
+                    [&name](const Column& c) { return c.name == name; });
+            if (column == columns.end())
+                column = columns.insert(column, {name, {}});
+            column->samples.push_back(std::strtod(field.c_str() + eq + 1, nullptr));
+        }
+    }
+
+    /// Whether a result line starts with the given contender and benchmark fields.
+    static bool hasKey(const std::string& line, const std::string& key) {
+        return !line.compare(0, key.size(), key)
+            && (line.size() == key.size() || line[key.size()] == '\t');
+    }
+
+    static bool converged(const std::vector<Column>& columns, double ci) {
+        return std::all_of(columns.begin(), columns.end(), [ci](const Column& c) {
+            return summarize(c.samples).relativeError() <= ci;
+        });
+    }
 
     std::string file_prefix_;
     std::vector<Contender> contenders_;
@@ -3,6 +3,7 @@
 
 #include <algorithm>
 #include <array>
+#include <cmath>
 #include <random>
 #include <vector>
 
@@ -44,6 +45,30 @@ class Generator {
         return result;
     }
 
+    /// Generates uniformly distributed weights in [0, 1).
+    static std::vector<double> generateWeights(size_t num, size_t seed = std::random_device{}()) {
+        std::mt19937_64 re{seed};
+        std::uniform_real_distribution<double> dist{0.0, 1.0};
+        std::vector<double> result(num);
+        std::generate(result.begin(), result.end(), [&]() { return dist(re); });
+        return result;
+    }
+
+    /// Query windows placed relative to the data, see generateWindows.
+    enum class Workload {
+        /// Windows spanned by two uniformly distributed corners (generateRectangles).
+        kRandom,
+        /// Windows of a target selectivity centred uniformly in the data's bounding box.
+        kSelectivity,
+        /// Windows of a target selectivity centred on data points.
+        kDataCentred,
+        /// Windows of a target selectivity around Zipf-distributed hot spots.
+        kZipf
+    };
+    static constexpr auto kSelectivitySample = 16384;
+    static constexpr auto kNumHotSpots = 1024;
+    static constexpr auto kZipfExponent = 1.0;
+
     template<class Scalar = double, size_t kDimensions = 2>
     static std::vector<std::pair<std::array<Scalar, kDimensions>, std::array<Scalar, kDimensions>>>
     generateRectangles(size_t num, Scalar min, Scalar max, size_t seed = std::random_device{}()) {
@@ -61,6 +86,103 @@ class Generator {
         return result;
     }
 
+    /// Generates windows that each contain roughly the given fraction of the
+    /// points. The side lengths have the ratio aspect : 1 : ... : 1. The size
+    /// of each window is estimated from a sample of the points around its centre.
+    template<class Scalar = double, size_t kDimensions = 2>
+    static std::vector<std::pair<std::array<Scalar, kDimensions>, std::array<Scalar, kDimensions>>>
+    generateWindows(size_t num, const std::vector<std::array<Scalar, kDimensions>>& points,
+            Workload workload, double selectivity, double aspect = 1.0,
+            size_t seed = std::random_device{}()) {
+        return generateWindows(num, points.data(), points.data() + points.size(),
+                workload, selectivity, aspect, seed);
+    }
+
+    template<class Scalar = double, size_t kDimensions = 2>
+    static std::vector<std::pair<std::array<Scalar, kDimensions>, std::array<Scalar, kDimensions>>>
+    generateWindows(size_t num, const std::array<Scalar, kDimensions>* first,
+            const std::array<Scalar, kDimensions>* last,
+            Workload workload, double selectivity, double aspect = 1.0,
+            size_t seed = std::random_device{}()) {
+        using Point = std::array<Scalar, kDimensions>;
+        const size_t num_points = last - first;
+        std::vector<std::pair<Point, Point>> result;
+        if (!num_points) return result;
+        result.reserve(num);
+
+        std::mt19937_64 re{seed};
+        std::vector<Point> sample;
+        if (num_points > kSelectivitySample) {
+            std::uniform_int_distribution<size_t> d_sample{0, num_points - 1};
+            for (size_t i = 0; i < kSelectivitySample; ++i)
+                sample.push_back(first[d_sample(re)]);
+        } else {
+            sample.assign(first, last);
+        }
+
+        Point lower = *first, upper = *first;
+        for (auto p = first; p != last; ++p)
+            for (size_t i = 0; i < kDimensions; ++i) {
+                lower[i] = std::min(lower[i], (*p)[i]);
+                upper[i] = std::max(upper[i], (*p)[i]);
+            }
+
+        // Zipf distribution over hot spots picked from the data
+        std::vector<Point> hot_spots(kNumHotSpots);
+        std::vector<double> weights(kNumHotSpots);
+        std::uniform_int_distribution<size_t> d_point{0, num_points - 1};
+        for (size_t i = 0; i < hot_spots.size(); ++i) {
+            hot_spots[i] = first[d_point(re)];
+            weights[i] = 1.0 / std::pow(i + 1, kZipfExponent);
+        }
+        std::discrete_distribution<size_t> d_hot_spot{weights.begin(), weights.end()};
+        std::uniform_real_distribution<double> d_unit{0.0, 1.0};
+
+        // Window radius needed to cover k sample points in the scaled maximum norm
+        const double wanted = selectivity * sample.size();
+        const size_t k = std::max<size_t>(1, std::min<size_t>(sample.size(), std::llround(wanted)));
+        const double correction = std::pow(wanted / k, 1.0 / kDimensions);
+        std::vector<double> distances(sample.size());
+        const auto radius = [&](const Point& centre) {
+            for (size_t j = 0; j < sample.size(); ++j) {
+                double d = std::abs(sample[j][0] - centre[0]);
+                for (size_t i = 1; i < kDimensions; ++i)
+                    d = std::max(d, aspect * std::abs(sample[j][i] - centre[i]));
+                distances[j] = d;
+            }
+            std::nth_element(distances.begin(), distances.begin() + (k - 1), distances.end());
+            return distances[k - 1] * correction;
+        };
+
+        while (result.size() < num) {
+            Point centre;
+            switch (workload) {
+            case Workload::kRandom:
+            case Workload::kSelectivity:
+                for (size_t i = 0; i < kDimensions; ++i)
+                    centre[i] = lower[i] + d_unit(re) * (upper[i] - lower[i]);
+                break;
+            case Workload::kDataCentred:
+                centre = first[d_point(re)];
+                break;
+            case Workload::kZipf:
+                centre = hot_spots[d_hot_spot(re)];
+                break;
+            }
+
+            const double r = radius(centre);
+            Point min = centre, max = centre;
+            min[0] -= r;
+            max[0] += r;
+            for (size_t i = 1; i < kDimensions; ++i) {
+                min[i] -= r / aspect;
+                max[i] += r / aspect;
+            }
+            result.emplace_back(min, max);
+        }
+        return result;
+    }
+
  private:
     template<class Scalar, size_t kDimensions>
     struct DistHelper {
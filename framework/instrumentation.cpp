@@ -1,9 +1,15 @@
 #include "instrumentation.h"
 
+#ifdef HAVE_PAPI
 #include <papi.h>
+#endif
+#include <algorithm>
+#include <cctype>
 #include <cmath>
 #include <iomanip>
 #include <iostream>
+#include <limits>
+#include <numeric>
 #include <stdexcept>
 
 namespace framework {
@@ -59,18 +65,216 @@ std::ostream& TimeInstrumentation::result(std::ostream& str, const std::string&
         std::chrono::duration_cast<std::chrono::nanoseconds>(duration_).count();
 }
 
-PapiInstrumentation::PapiInstrumentation(const std::vector<Event>& events) {
+constexpr unsigned LatencyHistogram::kSubBucketBits;
+constexpr uint64_t LatencyHistogram::kSubBuckets;
+
+LatencyHistogram::LatencyHistogram()
+    : counts_(bucket(std::numeric_limits<uint64_t>::max()) + 1, 0)
+    , count_(0)
+    , max_(0)
+{}
+
+void LatencyHistogram::clear() {
+    std::fill(counts_.begin(), counts_.end(), 0);
+    count_ = 0;
+    max_ = 0;
+}
+
+uint64_t LatencyHistogram::highestEquivalentValue(size_t bucket) {
+    if (bucket < kSubBuckets)
+        return bucket;
+    const size_t shift = (bucket - kSubBuckets) / (kSubBuckets / 2) + 1;
+    const uint64_t sub = (bucket - kSubBuckets) % (kSubBuckets / 2) + kSubBuckets / 2;
+    return (sub << shift) + ((uint64_t(1) << shift) - 1);
+}
+
+uint64_t LatencyHistogram::percentile(double fraction) const {
+    if (!count_) return 0;
+    const uint64_t rank = std::max<uint64_t>(1, std::ceil(fraction * count_));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts_.size(); ++i) {
+        seen += counts_[i];
+        if (seen >= rank)
+            return std::min(highestEquivalentValue(i), max_);
+    }
+    return max_;
+}
+
+void LatencyInstrumentation::start() {
+    timer_.histogram().clear();
+}
+
+void LatencyInstrumentation::stop() {}
+
+std::ostream& LatencyInstrumentation::print(std::ostream& str) const {
+    const auto& h = timer_.histogram();
+    if (!h.count()) return str;
+    using std::chrono::nanoseconds;
+    str << "Query latency p50:   ";
+    formatDuration(str, nanoseconds(h.percentile(0.5)));
+    str << "\nQuery latency p90:   ";
+    formatDuration(str, nanoseconds(h.percentile(0.9)));
+    str << "\nQuery latency p99:   ";
+    formatDuration(str, nanoseconds(h.percentile(0.99)));
+    str << "\nQuery latency p99.9: ";
+    formatDuration(str, nanoseconds(h.percentile(0.999)));
+    str << "\nQuery latency max:   ";
+    formatDuration(str, nanoseconds(h.max()));
+    return str << '\n';
+}
+
+std::ostream& LatencyInstrumentation::result(std::ostream& str, const std::string& sep) const {
+    // Preprocessing is not split into queries, so there is nothing to report.
+    const auto& h = timer_.histogram();
+    if (!h.count()) return str;
+    return str << sep << "p50=" << h.percentile(0.5)
+        << sep << "p90=" << h.percentile(0.9)
+        << sep << "p99=" << h.percentile(0.99)
+        << sep << "p999=" << h.percentile(0.999)
+        << sep << "max=" << h.max();
+}
+
+void TraversalInstrumentation::start() {
+    range_search::TraversalStats::get().reset();
+}
+
+void TraversalInstrumentation::stop() {
+    stats_ = range_search::TraversalStats::get();
+}
+
+size_t TraversalInstrumentation::levels() const {
+    size_t levels = range_search::TraversalStats::kMaxLevels;
+    while (levels > 0 && !stats_.nodes_visited[levels - 1])
+        --levels;
+    return levels;
+}
+
+size_t TraversalInstrumentation::nodesVisited() const {
+    return std::accumulate(std::begin(stats_.nodes_visited),
+            std::end(stats_.nodes_visited), size_t(0));
+}
+
+std::ostream& TraversalInstrumentation::print(std::ostream& str) const {
+    str << "Nodes visited:   " << nodesVisited();
+    for (size_t i = 0; i < levels(); ++i)
+        str << (i ? ", " : " (per level: ") << stats_.nodes_visited[i]
+            << (i + 1 == levels() ? ")" : "");
+    return str << "\nEntries tested:  " << stats_.entries_tested
+        << "\nEmpty subtrees:  " << stats_.empty_subtrees
+        << "\nPoints reported: " << stats_.points_reported
+        << '\n';
+}
+
+std::ostream& TraversalInstrumentation::result(std::ostream& str, const std::string& sep) const {
+    // Nothing is traversed during preprocessing or by unsupported data structures.
+    if (!levels()) return str;
+    str << sep << "visited=" << nodesVisited();
+    for (size_t i = 0; i < levels(); ++i)
+        str << sep << "visited" << i << '=' << stats_.nodes_visited[i];
+    return str << sep << "tested=" << stats_.entries_tested
+        << sep << "emptysub=" << stats_.empty_subtrees
+        << sep << "reported=" << stats_.points_reported;
+}
+
+void StructureInstrumentation::start() {
+    metrics_.clear();
+}
+
+void StructureInstrumentation::stop() {}
+
+void StructureInstrumentation::inspect(const std::function<range_search::Metrics()>& metrics) {
+    metrics_ = metrics();
+}
+
+std::ostream& StructureInstrumentation::print(std::ostream& str) const {
+    for (const auto& m : metrics_)
+        str << m.first << ": " << m.second << '\n';
+    return str;
+}
+
+std::ostream& StructureInstrumentation::result(std::ostream& str, const std::string& sep) const {
+    for (const auto& m : metrics_)
+        str << sep << m.first << '=' << m.second;
+    return str;
+}
+
+std::string CounterInstrumentation::columnName(const std::string& event) {
+    std::string name;
+    const size_t skip = event.compare(0, 5, "PAPI_") ? 0 : 5;
+    for (auto c = event.begin() + skip; c != event.end(); ++c)
+        if (std::isalnum(static_cast<unsigned char>(*c)))
+            name += std::tolower(static_cast<unsigned char>(*c));
+    return name;
+}
+
+std::vector<std::string> CounterInstrumentation::splitEvents(const std::string& list) {
+    std::vector<std::string> events;
+    for (size_t begin = 0, end; begin < list.size(); begin = end + 1) {
+        end = std::min(list.find(',', begin), list.size());
+        if (end > begin)
+            events.push_back(list.substr(begin, end - begin));
+    }
+    return events;
+}
+
+#ifdef HAVE_PAPI
+namespace {
+void initPapi() {
     const auto init = PAPI_library_init(PAPI_VER_CURRENT);
     if (init != PAPI_VER_CURRENT)
         throw std::runtime_error(std::string("Failed to initialize PAPI library: ")
                 + (init > 0 ? " Version mismatch" : PAPI_strerror(init)));
+}
+}  // namespace
+
+std::vector<PapiInstrumentation::Event> PapiInstrumentation::parseEvents(const std::string& list) {
+    initPapi();
+    std::vector<Event> events;
+    size_t width = 0;
+    PAPI_event_info_t info;
+    for (auto& name : splitEvents(list)) {
+        int code;
+        if (PAPI_event_name_to_code(const_cast<char*>(name.c_str()), &code) != PAPI_OK) {
+            std::string preset = "PAPI_";
+            for (char c : name)
+                preset += std::toupper(static_cast<unsigned char>(c));
+            if (auto err = PAPI_event_name_to_code(const_cast<char*>(preset.c_str()), &code)) {
+                std::cerr << "Error: Unknown PAPI event " << name << ": "
+                    << PAPI_strerror(err) << std::endl;
+                continue;
+            }
+        }
+        std::string desc = PAPI_get_event_info(code, &info) == PAPI_OK && info.short_descr[0]
+            ? info.short_descr : name;
+        width = std::max(width, desc.size());
+        events.push_back({code, columnName(name), desc});
+    }
+    for (auto& e : events) {
+        e.desc += ':';
+        e.desc.resize(width + 2, ' ');
+    }
+    return events;
+}
+
+PapiInstrumentation::PapiInstrumentation(const std::vector<Event>& events) {
+    initPapi();
     events_ = PAPI_NULL;
     if (auto err = PAPI_create_eventset(&events_))
         throw std::runtime_error(std::string("Failed to create PAPI event set: ") + PAPI_strerror(err));
 
+    bool multiplexed = false;
     PAPI_event_info_t info;
     for (auto& e : events) {
-        if (auto err = PAPI_add_event(events_, e.id)) {
+        auto err = PAPI_add_event(events_, e.id);
+        if (err == PAPI_ECNFLCT && !multiplexed) {
+            // out of hardware counters: time-share them, PAPI scales the counts
+            multiplexed = true;
+            if (!(err = PAPI_multiplex_init())
+                    && !(err = PAPI_assign_eventset_component(events_, 0))
+                    && !(err = PAPI_set_multiplex(events_)))
+                err = PAPI_add_event(events_, e.id);
+        }
+        if (err) {
             std::cerr << "Error: Failed to add PAPI event ";
             if (!PAPI_get_event_info(e.id, &info))
                 std::cerr << info.symbol;
@@ -80,6 +284,10 @@ PapiInstrumentation::PapiInstrumentation(const std::vector<Event>& events) {
             names_.emplace_back(e.name, e.desc);
         }
     }
+    if (names_.empty()) {
+        PAPI_destroy_eventset(&events_);
+        throw std::runtime_error("Failed to add any PAPI event");
+    }
     counters_.resize(names_.size(), 0);
 }
 
@@ -102,6 +310,11 @@ void PapiInstrumentation::stop() {
         throw std::runtime_error(std::string("Failed to read PAPI counters: ") + PAPI_strerror(err));
 }
 
+void PapiInstrumentation::read(long long* values) const {
+    if (auto err = PAPI_read(events_, values))
+        throw std::runtime_error(std::string("Failed to read PAPI counters: ") + PAPI_strerror(err));
+}
+
 std::ostream& PapiInstrumentation::print(std::ostream& str) const {
     if (counters_.empty()) return str;
     const auto w = std::setw(maxWidth(counters_.begin(), counters_.end()));
@@ -127,6 +340,66 @@ DefaultPapiInstrumentation::DefaultPapiInstrumentation()
         { PAPI_TOT_CYC, "totcyc", "Total cycles elapsed:  "}
     }}
 {}
+#endif  // HAVE_PAPI
+
+PhaseInstrumentation::PhaseInstrumentation(std::unique_ptr<CounterInstrumentation> counters)
+    : counters_(std::move(counters))
+{}
+
+void PhaseInstrumentation::start() {
+    auto& profiler = range_search::Profiler::get();
+    if (counters_) {
+        counters_->start();
+        auto counters = counters_.get();
+        profiler.enable([counters](long long* values) { counters->read(values); },
+                counters_->numEvents());
+    } else {
+        profiler.enable();
+    }
+    start_ = std::chrono::steady_clock::now();
+}
+
+void PhaseInstrumentation::stop() {
+    duration_ = std::chrono::steady_clock::now() - start_;
+    auto& profiler = range_search::Profiler::get();
+    profiler.disable();
+    if (counters_) counters_->stop();
+    phases_ = profiler.phases();
+    paths_.clear();
+    for (size_t i = 0; i < phases_.size(); ++i)
+        paths_.push_back(profiler.path(i, "_"));
+}
+
+std::ostream& PhaseInstrumentation::print(std::ostream& str) const {
+    str << "Time elapsed: ";
+    formatDuration(str, duration_);
+    str << '\n';
+    for (size_t i = 0; i < phases_.size(); ++i) {
+        const auto& phase = phases_[i];
+        size_t depth = 0;
+        for (size_t p = phase.parent; p != range_search::Profiler::kNone; p = phases_[p].parent)
+            ++depth;
+        const auto parent = phase.parent == range_search::Profiler::kNone
+            ? duration_ : phases_[phase.parent].duration;
+        str << std::string(2 * depth + 2, ' ') << phase.name << ": ";
+        formatDuration(str, phase.duration) << " (" << std::fixed << std::setprecision(1)
+            << (parent.count() ? 100.0 * phase.duration.count() / parent.count() : 0.0)
+            << std::defaultfloat << "%, " << phase.calls << " calls)\n";
+    }
+    return str;
+}
+
+std::ostream& PhaseInstrumentation::result(std::ostream& str, const std::string& sep) const {
+    str << sep << "time=" << std::chrono::duration_cast<std::chrono::nanoseconds>(duration_).count();
+    for (size_t i = 0; i < phases_.size(); ++i) {
+        const auto& phase = phases_[i];
+        str << sep << paths_[i] << '='
+            << std::chrono::duration_cast<std::chrono::nanoseconds>(phase.duration).count();
+        for (size_t c = 0; counters_ && c < counters_->numEvents(); ++c)
+            str << sep << paths_[i] << '_' << counters_->eventName(c) << '=' << phase.counters[c];
+    }
+    return str;
+}
 
 }  // namespace framework
 
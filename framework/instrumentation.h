@@ -2,12 +2,79 @@
 #define FRAMEWORK_INSTRUMENTATION_H_
 
 #include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <ostream>
 #include <tuple>
 #include <vector>
 
+#include "../profiler.h"
+#include "../range_search.h"
+#include "../traversal_stats.h"
+
 namespace framework {
 
+/// Log-linear ("HDR") histogram of latencies in nanoseconds. Values below
+/// kSubBuckets are recorded exactly, larger values with a relative error of at
+/// most 2 / kSubBuckets.
+class LatencyHistogram {
+ public:
+    static constexpr unsigned kSubBucketBits = 8;
+    static constexpr uint64_t kSubBuckets = uint64_t(1) << kSubBucketBits;
+
+    LatencyHistogram();
+
+    void record(uint64_t value) {
+        ++counts_[bucket(value)];
+        ++count_;
+        if (value > max_) max_ = value;
+    }
+
+    void clear();
+
+    /// Returns the smallest recorded value v such that at least the given
+    /// fraction of all recorded values is <= v (up to bucket precision).
+    uint64_t percentile(double fraction) const;
+    uint64_t max() const { return max_; }
+    uint64_t count() const { return count_; }
+
+ private:
+    static size_t bucket(uint64_t value) {
+        if (value < kSubBuckets)
+            return value;
+        const unsigned shift = 63 - __builtin_clzll(value) - (kSubBucketBits - 1);
+        return kSubBuckets + (shift - 1) * (kSubBuckets / 2)
+            + ((value >> shift) - kSubBuckets / 2);
+    }
+    static uint64_t highestEquivalentValue(size_t bucket);
+
+    std::vector<uint64_t> counts_;
+    uint64_t count_;
+    uint64_t max_;
+};
+
+/// Times individual queries. Kept non-virtual so the per-query overhead is a
+/// clock read (clock_gettime(CLOCK_MONOTONIC) via vDSO) and a bucket increment.
+class QueryTimer {
+ public:
+    void startQuery() {
+        start_ = std::chrono::steady_clock::now();
+    }
+
+    void stopQuery() {
+        histogram_.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start_).count());
+    }
+
+    LatencyHistogram& histogram() { return histogram_; }
+    const LatencyHistogram& histogram() const { return histogram_; }
+
+ private:
+    std::chrono::steady_clock::time_point start_;
+    LatencyHistogram histogram_;
+};
+
 class Instrumentation {
  public:
     virtual ~Instrumentation() {}
@@ -16,6 +83,18 @@ class Instrumentation {
     virtual void stop() = 0;
     virtual std::ostream& print(std::ostream&) const = 0;
     virtual std::ostream& result(std::ostream&, const std::string& = "\t") const = 0;
+
+    /// Returns a timer that must be started and stopped around every single
+    /// query, or nullptr if the instrumentation only measures whole phases.
+    virtual QueryTimer* queryTimer() { return nullptr; }
+
+    /// Called after preprocessing with a function computing the data
+    /// structure's metrics (see range_search::RangeSearch::metrics).
+    virtual void inspect(const std::function<range_search::Metrics()>&) {}
+
+    /// Whether larger results are worse, so that an increase over a baseline
+    /// counts as a regression (see Experiments::compareToBaseline).
+    virtual bool measuresCost() const { return true; }
 };
 
 class TimeInstrumentation : public Instrumentation {
@@ -30,7 +109,64 @@ class TimeInstrumentation : public Instrumentation {
     std::chrono::steady_clock::duration duration_;
 };
 
-class PapiInstrumentation : public Instrumentation {
+class LatencyInstrumentation : public Instrumentation {
+ public:
+    void start() override;
+    void stop() override;
+    std::ostream& print(std::ostream&) const override;
+    std::ostream& result(std::ostream&, const std::string&) const override;
+    QueryTimer* queryTimer() override { return &timer_; }
+
+ private:
+    QueryTimer timer_;
+};
+
+/// Reports the range_search::TraversalStats counters. They are only maintained
+/// if the data structures are compiled with RANGE_SEARCH_TRAVERSAL_STATS.
+class TraversalInstrumentation : public Instrumentation {
+ public:
+    void start() override;
+    void stop() override;
+    std::ostream& print(std::ostream&) const override;
+    std::ostream& result(std::ostream&, const std::string&) const override;
+
+ private:
+    size_t levels() const;
+    size_t nodesVisited() const;
+
+    range_search::TraversalStats stats_;
+};
+
+/// Reports the metrics a data structure gives about itself after preprocessing.
+class StructureInstrumentation : public Instrumentation {
+ public:
+    void start() override;
+    void stop() override;
+    std::ostream& print(std::ostream&) const override;
+    std::ostream& result(std::ostream&, const std::string&) const override;
+    void inspect(const std::function<range_search::Metrics()>&) override;
+    bool measuresCost() const override { return false; }
+
+ private:
+    range_search::Metrics metrics_;
+};
+
+/// Instrumentation reading a set of hardware performance counters.
+class CounterInstrumentation : public Instrumentation {
+ public:
+    /// Reads the running counters without stopping them.
+    virtual void read(long long* values) const = 0;
+    virtual size_t numEvents() const = 0;
+    virtual const std::string& eventName(size_t i) const = 0;
+
+    /// Result column of an event given by name, e.g. "l2dcm" for "PAPI_L2_DCM".
+    static std::string columnName(const std::string& event);
+    /// Splits a comma-separated list of event names.
+    static std::vector<std::string> splitEvents(const std::string& list);
+};
+
+/// Only available if built with PAPI (HAVE_PAPI), see PerfInstrumentation otherwise.
+class PapiInstrumentation : public CounterInstrumentation {
  public:
     struct Event {
         int id;
@@ -38,14 +174,23 @@ class PapiInstrumentation : public Instrumentation {
         std::string desc;
     };
 
+    /// Switches to multiplexing if the events do not fit the hardware counters.
     PapiInstrumentation(const std::vector<Event>&);
     ~PapiInstrumentation();
 
+    /// Looks up PAPI preset or native events by name, the "PAPI_" prefix is
+    /// optional. Unknown events are skipped with a warning.
+    static std::vector<Event> parseEvents(const std::string& list);
+
     void start() override;
     void stop() override;
     std::ostream& print(std::ostream&) const override;
     std::ostream& result(std::ostream&, const std::string&) const override;
 
+    void read(long long* values) const override;
+    size_t numEvents() const override { return names_.size(); }
+    const std::string& eventName(size_t i) const override { return names_[i].first; }
+
  private:
     int events_;
     std::vector<long long> counters_;
@@ -57,6 +202,25 @@ class DefaultPapiInstrumentation : public PapiInstrumentation {
     DefaultPapiInstrumentation();
 };
 
+/// Breaks preprocessing down into the phases marked with PROFILE_SCOPE, see
+/// profiler.h. If given hardware counters, they are attributed to the phases too.
+class PhaseInstrumentation : public Instrumentation {
+ public:
+    explicit PhaseInstrumentation(std::unique_ptr<CounterInstrumentation> counters = nullptr);
+
+    void start() override;
+    void stop() override;
+    std::ostream& print(std::ostream&) const override;
+    std::ostream& result(std::ostream&, const std::string&) const override;
+
+ private:
+    std::unique_ptr<CounterInstrumentation> counters_;
+    std::vector<range_search::Profiler::Phase> phases_;
+    std::vector<std::string> paths_;
+    std::chrono::steady_clock::time_point start_;
+    std::chrono::steady_clock::duration duration_;
+};
+
 }  // namespace framework
 #endif  // FRAMEWORK_INSTRUMENTATION_H_
 
@@ -28,6 +28,7 @@ void MemoryInstrumentation::stop() {
     peak_ = malloc_count_peak() - base_;
     total_ = malloc_count_total();
     count_ = malloc_count_num_allocs();
+    retained_ = static_cast<long long>(malloc_count_current()) - static_cast<long long>(base_);
 }
 
 std::ostream& MemoryInstrumentation::print(std::ostream& str) const {
@@ -35,12 +36,24 @@ std::ostream& MemoryInstrumentation::print(std::ostream& str) const {
     return str << "Peak memory usage:      " << w << peak_ / (1024 * 1024) << " MB"
         << "\nTotal memory allocated: " << w << total_ / (1024 * 1024) << " MB"
         << "\nNumber of allocations:  " << w << count_
+        << "\nMemory retained:        " << w << retained_ / (1024 * 1024) << " MB"
+        << "\nTransient peak memory:  " << w << transient() / (1024 * 1024) << " MB"
+        << "\nPeak / retained:        " << w << std::round(peakRatio() * 100) / 100
         << '\n';
 }
 
 std::ostream& MemoryInstrumentation::result(std::ostream& str, const std::string& sep) const {
     return str << sep << "peakmem=" << peak_ << sep << "alloc=" << total_
-        << sep << "nalloc=" << count_;
+        << sep << "nalloc=" << count_ << sep << "retained=" << retained_
+        << sep << "transient=" << transient() << sep << "peakratio=" << peakRatio();
+}
+
+long long MemoryInstrumentation::transient() const {
+    return static_cast<long long>(peak_) - retained_;
+}
+
+double MemoryInstrumentation::peakRatio() const {
+    return retained_ > 0 ? static_cast<double>(peak_) / retained_ : 0;
 }
 
 }  // namespace framework
@@ -12,8 +12,18 @@ class MemoryInstrumentation : public Instrumentation {
     std::ostream& print(std::ostream&) const override;
     std::ostream& result(std::ostream&, const std::string&) const override;
 
+    /// Peak memory beyond what is retained, e.g. buffers used only while
+    /// building a data structure.
+    long long transient() const;
+    /// Peak memory relative to the memory retained, the target to keep close
+    /// to 1 for preprocessing; 0 if nothing is retained.
+    double peakRatio() const;
+
  private:
     size_t base_, peak_, total_, count_;
+    /// Memory allocated during the phase and still in use after it, e.g. the
+    /// data structure after preprocessing. Negative if more was freed.
+    long long retained_;
 };
 
 }  // namespace framework
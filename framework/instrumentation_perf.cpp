@@ -0,0 +1,244 @@
+#include "instrumentation_perf.h"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <strings.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+namespace framework {
+
+constexpr size_t PerfInstrumentation::kMaxGroupSize;
+
+namespace {
+int openEvent(const PerfInstrumentation::Event& e, int group_fd) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = e.type;
+    attr.config = e.config;
+    attr.disabled = group_fd == -1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+        | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+constexpr uint64_t cacheEvent(uint64_t cache, uint64_t op, uint64_t result) {
+    return cache | (op << 8) | (result << 16);
+}
+
+struct NamedEvent {
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+};
+
+// matched against the column name, i.e. in lower case without punctuation
+const NamedEvent kNamedEvents[] = {
+    { "cycles",                PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "cpucycles",             PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "totcyc",                PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions",          PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "totins",                PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "cachereferences",       PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES },
+    { "cachemisses",           PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { "l3tcm",                 PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { "branches",              PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+    { "branchinstructions",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+    { "brins",                 PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+    { "branchmisses",          PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { "brmsp",                 PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { "buscycles",             PERF_TYPE_HARDWARE, PERF_COUNT_HW_BUS_CYCLES },
+    { "refcycles",             PERF_TYPE_HARDWARE, PERF_COUNT_HW_REF_CPU_CYCLES },
+    { "stalledcyclesfrontend", PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_FRONTEND },
+    { "stallfe",               PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_FRONTEND },
+    { "stalledcyclesbackend",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND },
+    { "stallbe",               PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND },
+    { "l1dcm",                 PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_L1D,
+        PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+    { "tlbdm",                 PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_DTLB,
+        PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+    { "dtlbm",                 PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_DTLB,
+        PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+    { "cpuclock",              PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK },
+    { "taskclock",             PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+    { "pagefaults",            PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+    { "faults",                PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+    { "minorfaults",           PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MIN },
+    { "majorfaults",           PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MAJ },
+    { "contextswitches",       PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+    { "cpumigrations",         PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS },
+};
+
+// generic cache events, spelled <cache>-<op>s or <cache>-<op>-misses like perf(1)
+const NamedEvent kCaches[] = {
+    { "L1-dcache-", 0, PERF_COUNT_HW_CACHE_L1D },
+    { "L1-icache-", 0, PERF_COUNT_HW_CACHE_L1I },
+    { "LLC-",       0, PERF_COUNT_HW_CACHE_LL },
+    { "dTLB-",      0, PERF_COUNT_HW_CACHE_DTLB },
+    { "iTLB-",      0, PERF_COUNT_HW_CACHE_ITLB },
+    { "branch-",    0, PERF_COUNT_HW_CACHE_BPU },
+    { "node-",      0, PERF_COUNT_HW_CACHE_NODE },
+};
+const NamedEvent kCacheOps[] = {
+    { "load",     0, PERF_COUNT_HW_CACHE_OP_READ },
+    { "store",    0, PERF_COUNT_HW_CACHE_OP_WRITE },
+    { "prefetch", 0, PERF_COUNT_HW_CACHE_OP_PREFETCH },
+};
+
+bool lookupCacheEvent(const std::string& name, uint64_t& config) {
+    for (auto& cache : kCaches) {
+        if (strncasecmp(name.c_str(), cache.name, strlen(cache.name)))
+            continue;
+        const std::string rest = name.substr(strlen(cache.name));
+        for (auto& op : kCacheOps) {
+            if (rest == std::string(op.name) + "s")
+                config = cacheEvent(cache.config, op.config, PERF_COUNT_HW_CACHE_RESULT_ACCESS);
+            else if (rest == std::string(op.name) + "-misses")
+                config = cacheEvent(cache.config, op.config, PERF_COUNT_HW_CACHE_RESULT_MISS);
+            else
+                continue;
+            return true;
+        }
+    }
+    return false;
+}
+
+template<class It>
+size_t maxWidth(It begin, It end) {
+    double max = 1;
+    while (begin != end)
+        max = std::max(max, std::log10(*begin++));
+    return std::ceil(max);
+}
+}  // namespace
+
+PerfInstrumentation::PerfInstrumentation(const std::vector<Event>& events) {
+    for (auto& e : events) {
+        const bool new_group = groups_.empty() || groups_.back().members.size() + 1 >= kMaxGroupSize;
+        const int fd = openEvent(e, new_group ? -1 : groups_.back().leader);
+        if (fd < 0) {
+            std::cerr << "Error: Failed to open perf event " << e.name << ": "
+                << strerror(errno) << std::endl;
+            continue;
+        }
+        if (new_group)
+            groups_.push_back({fd, {}});
+        else
+            groups_.back().members.push_back(fd);
+        names_.emplace_back(e.name, e.desc);
+    }
+    if (groups_.empty())
+        throw std::runtime_error("Failed to open any perf event");
+    counters_.resize(names_.size(), 0);
+}
+
+PerfInstrumentation::~PerfInstrumentation() {
+    for (auto& g : groups_) {
+        for (int fd : g.members)
+            close(fd);
+        close(g.leader);
+    }
+}
+
+void PerfInstrumentation::start() {
+    for (auto& g : groups_)
+        if (ioctl(g.leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP))
+            throw std::runtime_error(std::string("Failed to reset perf counters: ") + strerror(errno));
+    for (auto& g : groups_)
+        if (ioctl(g.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP))
+            throw std::runtime_error(std::string("Failed to start perf counters: ") + strerror(errno));
+}
+
+void PerfInstrumentation::stop() {
+    for (auto& g : groups_)
+        if (ioctl(g.leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP))
+            throw std::runtime_error(std::string("Failed to stop perf counters: ") + strerror(errno));
+    read(counters_.data());
+}
+
+void PerfInstrumentation::read(long long* values) const {
+    // layout for PERF_FORMAT_GROUP with both times
+    uint64_t buffer[3 + kMaxGroupSize];
+    for (auto& g : groups_) {
+        const size_t size = (3 + 1 + g.members.size()) * sizeof(uint64_t);
+        if (::read(g.leader, buffer, size) != static_cast<ssize_t>(size))
+            throw std::runtime_error(std::string("Failed to read perf counters: ") + strerror(errno));
+        const uint64_t enabled = buffer[1], running = buffer[2];
+        for (size_t i = 0; i < buffer[0]; ++i)
+            *values++ = running == 0 ? 0
+                : running == enabled ? buffer[3 + i]
+                : static_cast<long long>(static_cast<double>(buffer[3 + i]) * enabled / running);
+    }
+}
+
+std::ostream& PerfInstrumentation::print(std::ostream& str) const {
+    const auto w = std::setw(maxWidth(counters_.begin(), counters_.end()));
+    for (size_t i = 0; i < counters_.size(); ++i)
+        str << names_[i].second << w << counters_[i] << '\n';
+    return str;
+}
+
+std::ostream& PerfInstrumentation::result(std::ostream& str, const std::string& sep) const {
+    for (size_t i = 0; i < counters_.size(); ++i)
+        str << sep << names_[i].first << '=' << counters_[i];
+    return str;
+}
+
+std::vector<PerfInstrumentation::Event> PerfInstrumentation::parseEvents(const std::string& list) {
+    std::vector<Event> events;
+    size_t width = 0;
+    for (auto& name : splitEvents(list)) {
+        const auto column = columnName(name);
+        Event e{PERF_TYPE_HARDWARE, 0, column, name};
+        const auto named = std::find_if(std::begin(kNamedEvents), std::end(kNamedEvents),
+                [&column](const NamedEvent& n) { return column == n.name; });
+        if (named != std::end(kNamedEvents)) {
+            e.type = named->type;
+            e.config = named->config;
+        } else if (lookupCacheEvent(name, e.config)) {
+            e.type = PERF_TYPE_HW_CACHE;
+        } else if (name.size() > 1 && name[0] == 'r'
+                && name.find_first_not_of("0123456789abcdefABCDEF", 1) == std::string::npos) {
+            e.type = PERF_TYPE_RAW;
+            e.config = std::strtoull(name.c_str() + 1, nullptr, 16);
+        } else {
+            std::cerr << "Error: Unknown perf event " << name << std::endl;
+            continue;
+        }
+        width = std::max(width, name.size());
+        events.push_back(std::move(e));
+    }
+    for (auto& e : events) {
+        e.desc += ':';
+        e.desc.resize(width + 2, ' ');
+    }
+    return events;
+}
+
+DefaultPerfInstrumentation::DefaultPerfInstrumentation()
+    : PerfInstrumentation{{
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "totcyc", "Total cycles elapsed:  "},
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "totins", "Total instructions:    "},
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "l3tcm", "L3 total cache misses: "},
+        { PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ,
+                PERF_COUNT_HW_CACHE_RESULT_MISS), "l1dcm", "L1 data cache misses:  "},
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "brmsp", "Branch mispredictions: "},
+        { PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+                PERF_COUNT_HW_CACHE_RESULT_MISS), "dtlbm", "dTLB misses:           "},
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_FRONTEND, "stallfe", "Front end stalls:      "},
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND, "stallbe", "Back end stalls:       "}
+    }}
+{}
+
+}  // namespace framework
@@ -0,0 +1,65 @@
+#ifndef FRAMEWORK_INSTRUMENTATION_PERF_H_
+#define FRAMEWORK_INSTRUMENTATION_PERF_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "instrumentation.h"
+
+namespace framework {
+
+/// Hardware counters read through Linux' perf_event_open, without PAPI.
+/// Events are opened in groups that are read atomically; if the kernel has to
+/// multiplex the groups, the counts are scaled to the full measurement time.
+class PerfInstrumentation : public CounterInstrumentation {
+ public:
+    struct Event {
+        uint32_t type;
+        uint64_t config;
+        std::string name;
+        std::string desc;
+    };
+    /// Maximum number of events read atomically, should not exceed the number
+    /// of general purpose counters.
+    static constexpr size_t kMaxGroupSize = 4;
+
+    /// If there are more groups than hardware counters, the kernel multiplexes
+    /// them and the counts are scaled accordingly.
+    PerfInstrumentation(const std::vector<Event>&);
+    ~PerfInstrumentation();
+
+    /// Looks up events by the names perf(1) uses (e.g. "dTLB-load-misses"),
+    /// raw events ("r01a2"), or the PAPI presets used by DefaultPapiInstrumentation
+    /// (e.g. "TOT_CYC" or "totcyc"). Unknown events are skipped with a warning.
+    static std::vector<Event> parseEvents(const std::string& list);
+
+    void start() override;
+    void stop() override;
+    std::ostream& print(std::ostream&) const override;
+    std::ostream& result(std::ostream&, const std::string&) const override;
+
+    void read(long long* values) const override;
+    size_t numEvents() const override { return names_.size(); }
+    const std::string& eventName(size_t i) const override { return names_[i].first; }
+
+ private:
+    struct Group {
+        int leader;
+        std::vector<int> members;
+    };
+
+    std::vector<Group> groups_;
+    std::vector<long long> counters_;
+    std::vector<std::pair<std::string, std::string>> names_;
+};
+
+/// The events of DefaultPapiInstrumentation (under the same names), plus dTLB
+/// misses and stalled cycles.
+class DefaultPerfInstrumentation : public PerfInstrumentation {
+ public:
+    DefaultPerfInstrumentation();
+};
+
+}  // namespace framework
+#endif  // FRAMEWORK_INSTRUMENTATION_PERF_H_
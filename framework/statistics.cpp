@@ -0,0 +1,109 @@
+#include "statistics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace framework {
+
+namespace {
+// expects sorted samples
+double median(const std::vector<double>& sorted) {
+    const size_t n = sorted.size();
+    return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+double variance(const std::vector<double>& samples, double mean) {
+    double sum = 0;
+    for (auto x : samples)
+        sum += (x - mean) * (x - mean);
+    return sum / (samples.size() - 1);
+}
+
+// continued fraction of the regularized incomplete beta function, converges
+// for x < (a + 1) / (a + b + 2)
+double betaFraction(double a, double b, double x) {
+    const double tiny = 1e-300;
+    double c = 1, d = 1 - (a + b) * x / (a + 1);
+    d = 1 / (std::abs(d) < tiny ? tiny : d);
+    double f = d;
+    for (int m = 1; m <= 300; ++m) {
+        for (int odd = 0; odd < 2; ++odd) {
+            const double num = odd
+                ? -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1))
+                : m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m));
+            d = 1 + num * d;
+            d = 1 / (std::abs(d) < tiny ? tiny : d);
+            c = 1 + num / c;
+            if (std::abs(c) < tiny) c = tiny;
+            f *= c * d;
+            if (odd && std::abs(c * d - 1) < 1e-15)
+                return f;
+        }
+    }
+    return f;
+}
+
+// regularized incomplete beta function I_x(a, b)
+double incompleteBeta(double a, double b, double x) {
+    if (x <= 0) return 0;
+    if (x >= 1) return 1;
+    const double front = std::exp(std::lgamma(a + b) - std::lgamma(a) - std::lgamma(b)
+            + a * std::log(x) + b * std::log1p(-x));
+    return x < (a + 1) / (a + b + 2)
+        ? front * betaFraction(a, b, x) / a
+        : 1 - front * betaFraction(b, a, 1 - x) / b;
+}
+}  // namespace
+
+double mean(const std::vector<double>& samples) {
+    double sum = 0;
+    for (auto x : samples)
+        sum += x;
+    return samples.empty() ? 0 : sum / samples.size();
+}
+
+double welchTTest(const std::vector<double>& a, const std::vector<double>& b) {
+    if (a.size() < 2 || b.size() < 2)
+        return std::numeric_limits<double>::quiet_NaN();
+    const double mean_a = mean(a), mean_b = mean(b);
+    const double se_a = variance(a, mean_a) / a.size(), se_b = variance(b, mean_b) / b.size();
+    if (se_a + se_b == 0)
+        return mean_a == mean_b ? 1 : 0;
+    const double t = (mean_a - mean_b) / std::sqrt(se_a + se_b);
+    const double df = (se_a + se_b) * (se_a + se_b)
+        / (se_a * se_a / (a.size() - 1) + se_b * se_b / (b.size() - 1));
+    return incompleteBeta(df / 2, 0.5, df / (df + t * t));
+}
+
+double Summary::relativeError() const {
+    if (ci_clamped) return std::numeric_limits<double>::infinity();
+    if (ci_high == ci_low) return 0;
+    if (median == 0) return std::numeric_limits<double>::infinity();
+    return (ci_high - ci_low) / 2 / std::abs(median);
+}
+
+Summary summarize(std::vector<double> samples) {
+    Summary s;
+    s.count = samples.size();
+    if (samples.empty()) return s;
+    std::sort(samples.begin(), samples.end());
+    s.median = median(samples);
+
+    // the number of samples below the median is Binomial(n, 1/2); using its
+    // normal approximation, [x_(lo), x_(hi)] covers the median with 95%
+    const double n = samples.size();
+    const double spread = 1.96 * std::sqrt(n) / 2;
+    const auto lo = static_cast<long>(std::floor(n / 2 - spread));
+    const auto hi = static_cast<long>(std::ceil(n / 2 + spread));
+    s.ci_low = samples[std::max(lo, 1L) - 1];
+    s.ci_high = samples[std::min<long>(hi, samples.size()) - 1];
+    s.ci_clamped = lo < 1 || hi > static_cast<long>(samples.size());
+
+    for (auto& x : samples)
+        x = std::abs(x - s.median);
+    std::sort(samples.begin(), samples.end());
+    s.mad = median(samples);
+    return s;
+}
+
+}  // namespace framework
@@ -0,0 +1,36 @@
+#ifndef FRAMEWORK_STATISTICS_H_
+#define FRAMEWORK_STATISTICS_H_
+
+#include <cstddef>
+#include <vector>
+
+namespace framework {
+
+/// Robust summary of repeated measurements.
+struct Summary {
+    size_t count = 0;
+    double median = 0;
+    /// Median absolute deviation from the median (unscaled).
+    double mad = 0;
+    /// Distribution-free 95% confidence interval of the median, taken from the
+    /// order statistics. Spans all samples if there are too few of them.
+    double ci_low = 0;
+    double ci_high = 0;
+    /// Whether there were too few samples (fewer than 8) for the interval.
+    bool ci_clamped = true;
+
+    /// Half the width of the confidence interval relative to the median;
+    /// infinite if the interval is clamped.
+    double relativeError() const;
+};
+
+Summary summarize(std::vector<double> samples);
+
+double mean(const std::vector<double>& samples);
+
+/// Two-sided p-value of Welch's t-test for equal means of two samples with
+/// possibly different variances. NaN if either has fewer than two samples.
+double welchTTest(const std::vector<double>& a, const std::vector<double>& b);
+
+}  // namespace framework
+#endif  // FRAMEWORK_STATISTICS_H_
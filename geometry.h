@@ -4,9 +4,14 @@
 #ifndef GEOMETRY_H_
 #define GEOMETRY_H_
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <limits>
 #include <iomanip>
+#include <stdexcept>
+#include <utility>
+#include <vector>
 
 #if DEBUG
   #define Assert(expr) if (!(expr)) { std::cerr << "Assertion \"" << #expr << "\" failed (in " << __FILE__ << ":" << __LINE__ << "). Aborting" << std::endl; abort(); }
@@ -19,6 +24,13 @@ enum Axis: size_t {
   Y = 1
 };
 
+// How a rectangle relates to a query shape, see Circle::Classify and ConvexPolygon::Classify.
+enum class Coverage {
+  kDisjoint,   // No point of the rectangle lies in the shape.
+  kPartial,    // Some, but not all points of the rectangle lie in the shape.
+  kContained   // The rectangle lies entirely in the shape.
+};
+
 
 template<class Point>
 class Rectangle {
@@ -53,14 +65,56 @@ public:
            p[1] <= top_right_[1];
   }
 
+  bool Contains(const Rectangle& other) const {
+    return Contains(other.bottom_left_) && Contains(other.top_right_);
+  }
+
   bool Intersects(Axis axis, double offset) const {
     return bottom_left_[axis] < offset && top_right_[axis] > offset;
   }
 
+  // The part below / above an axis-aligned line through the rectangle.
+  Rectangle ClipBelow(Axis axis, double offset) const {
+    Rectangle r = *this;
+    r.top_right_[axis] = offset;
+    return r;
+  }
+
+  Rectangle ClipAbove(Axis axis, double offset) const {
+    Rectangle r = *this;
+    r.bottom_left_[axis] = offset;
+    return r;
+  }
+
+  // Grow to the bounding box of this rectangle and other.
+  void Extend(const Rectangle& other) {
+    for (int axis = 0; axis < 2; ++axis) {
+      bottom_left_[axis] = std::min(bottom_left_[axis], other.bottom_left_[axis]);
+      top_right_[axis] = std::max(top_right_[axis], other.top_right_[axis]);
+    }
+  }
+
   double Area() const {
     return (top_right_[0] - bottom_left_[0]) * (top_right_[1] - bottom_left_[1]);
   }
 
+  // Area of the intersection with another rectangle, 0 if they do not overlap.
+  double OverlapArea(const Rectangle& other) const {
+    double width = std::min(top_right_[0], other.top_right_[0]) - std::max(bottom_left_[0], other.bottom_left_[0]);
+    double height = std::min(top_right_[1], other.top_right_[1]) - std::max(bottom_left_[1], other.bottom_left_[1]);
+    return width > 0 && height > 0 ? width * height : 0;
+  }
+
+  // Squared distance from p to the nearest point of the rectangle, 0 if it contains p.
+  double SquaredDistance(const Point& p) const {
+    double distance = 0;
+    for (int axis = 0; axis < 2; ++axis) {
+      const double d = p[axis] < bottom_left_[axis] ? bottom_left_[axis] - p[axis] : p[axis] > top_right_[axis] ? p[axis] - top_right_[axis] : 0;
+      distance += d * d;
+    }
+    return distance;
+  }
+
   static Rectangle BoundingBox(const std::vector<Point>& points) {
     Assert(points.size() > 0);
 
@@ -94,4 +148,120 @@ public:
   }
 };
 
+// Disk with the given centre and radius, boundary included.
+template<class Point>
+class Circle {
+
+public:
+
+  Circle(const Point& center, double radius) : center_(center), radius_(radius) {}
+
+  const Point& center() const { return center_; }
+  double radius() const { return radius_; }
+
+  bool Contains(const Point& p) const {
+    const double dx = p[0] - center_[0];
+    const double dy = p[1] - center_[1];
+    return dx * dx + dy * dy <= radius_ * radius_;
+  }
+
+  // Rounded outwards, so that it includes every point Contains accepts.
+  Rectangle<Point> BoundingBox() const {
+    const double inf = std::numeric_limits<double>::infinity();
+    return Rectangle<Point>({{std::nextafter(center_[0] - radius_, -inf), std::nextafter(center_[1] - radius_, -inf)}},
+                            {{std::nextafter(center_[0] + radius_, inf), std::nextafter(center_[1] + radius_, inf)}});
+  }
+
+  // Compare the distances of the rectangle's nearest and farthest point to the radius.
+  Coverage Classify(const Rectangle<Point>& r) const {
+    double nearest = 0, farthest = 0;
+    for (size_t axis = 0; axis < 2; ++axis) {
+      const double lo = r.min_side(static_cast<Axis>(axis)) - center_[axis];
+      const double hi = r.max_side(static_cast<Axis>(axis)) - center_[axis];
+      const double near = lo > 0 ? lo : hi < 0 ? hi : 0;
+      const double far = std::max(-lo, hi);
+      nearest += near * near;
+      farthest += far * far;
+    }
+    const double r2 = radius_ * radius_;
+    return nearest > r2 ? Coverage::kDisjoint : farthest <= r2 ? Coverage::kContained : Coverage::kPartial;
+  }
+
+private:
+  Point center_;
+  double radius_;
+};
+
+// Convex polygon given by at least three vertices in clockwise or counterclockwise order, boundary
+// included. Fewer vertices throw std::invalid_argument.
+template<class Point>
+class ConvexPolygon {
+
+public:
+
+  explicit ConvexPolygon(std::vector<Point> vertices) : vertices_(std::move(vertices)) {
+    if (vertices_.size() < 3) {
+      throw std::invalid_argument("a polygon needs at least three vertices");
+    }
+    double twice_area = 0;
+    for (size_t i = 0; i < vertices_.size(); ++i) {
+      const Point& a = vertices_[i];
+      const Point& b = vertices_[(i + 1) % vertices_.size()];
+      twice_area += a[0] * b[1] - b[0] * a[1];
+    }
+    // Counterclockwise, so that the inside lies to the left of every edge.
+    if (twice_area < 0) {
+      std::reverse(vertices_.begin(), vertices_.end());
+    }
+    bounding_box_ = Rectangle<Point>::BoundingBox(vertices_);
+  }
+
+  const std::vector<Point>& vertices() const { return vertices_; }
+
+  bool Contains(const Point& p) const {
+    for (size_t i = 0; i < vertices_.size(); ++i) {
+      if (Side(i, p) < 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  const Rectangle<Point>& BoundingBox() const { return bounding_box_; }
+
+  // Separating axis test: the rectangle is disjoint if it lies outside the polygon's bounding box
+  // or entirely outside one edge, and contained if all its corners lie inside every edge.
+  Coverage Classify(const Rectangle<Point>& r) const {
+    if (!bounding_box_.Overlaps(r)) {
+      return Coverage::kDisjoint;
+    }
+    const Point corners[4] = {
+      r.bottom_left(), {{r.max_side(X), r.min_side(Y)}}, r.top_right(), {{r.min_side(X), r.max_side(Y)}}
+    };
+    bool contained = true;
+    for (size_t i = 0; i < vertices_.size(); ++i) {
+      size_t outside = 0;
+      for (const Point& corner : corners) {
+        outside += Side(i, corner) < 0;
+      }
+      if (outside == 4) {
+        return Coverage::kDisjoint;
+      }
+      contained &= outside == 0;
+    }
+    return contained ? Coverage::kContained : Coverage::kPartial;
+  }
+
+private:
+  // Positive if p lies to the left of edge i, 0 if on its line.
+  double Side(size_t i, const Point& p) const {
+    const Point& a = vertices_[i];
+    const Point& b = vertices_[i + 1 == vertices_.size() ? 0 : i + 1];
+    return (b[0] - a[0]) * (p[1] - a[1]) - (b[1] - a[1]) * (p[0] - a[0]);
+  }
+
+  std::vector<Point> vertices_;
+  Rectangle<Point> bounding_box_;
+};
+
 #endif  // GEOMETRY_H_
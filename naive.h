@@ -12,6 +12,51 @@ class Naive : public RangeSearch<Point> {
  public:
     void assign(const std::vector<Point>& points) override {
         dataset_ = points;
+        weights_.clear();
+        weighted_ = false;
+    }
+
+    void assign(const Point* begin, const Point* end) override {
+        dataset_.assign(begin, end);
+        weights_.clear();
+        weighted_ = false;
+    }
+
+    void assignWeighted(const Point* begin, const Point* end, const double* weights) override {
+        dataset_.assign(begin, end);
+        weights_.assign(weights, weights + dataset_.size());
+        weighted_ = true;
+    }
+
+    void applyDelta(const std::vector<Point>& inserts, const std::vector<Point>& deletes) override {
+        std::vector<Point> sorted_deletes(deletes);
+        std::sort(sorted_deletes.begin(), sorted_deletes.end());
+        // Number of occurrences still to remove per point.
+        std::vector<std::pair<Point, size_t>> pending;
+        for (const Point& p : sorted_deletes) {
+            if (pending.empty() || pending.back().first != p)
+                pending.emplace_back(p, 0);
+            ++pending.back().second;
+        }
+        // Compacts points and weights alike.
+        size_t kept = 0;
+        for (size_t i = 0; i < dataset_.size(); ++i) {
+            auto it = std::lower_bound(pending.begin(), pending.end(), std::make_pair(dataset_[i], size_t(0)));
+            if (it != pending.end() && it->first == dataset_[i] && it->second > 0) {
+                --it->second;
+                continue;
+            }
+            dataset_[kept] = dataset_[i];
+            if (weighted_)
+                weights_[kept] = weights_[i];
+            ++kept;
+        }
+        dataset_.erase(dataset_.begin() + kept, dataset_.end());
+        dataset_.insert(dataset_.end(), inserts.begin(), inserts.end());
+        if (weighted_) {
+            weights_.resize(kept);
+            weights_.resize(dataset_.size(), 0.0);
+        }
     }
 
     void reportRange(const Point& min, const Point& max, std::vector<Point>& result) override {
@@ -22,8 +67,46 @@ class Naive : public RangeSearch<Point> {
         return processRange<false>(min, max, nullptr);
     }
 
+    void reportCircle(const Point& center, double radius, std::vector<Point>& result) override {
+        const Circle<Point> circle(center, radius);
+        std::copy_if(dataset_.begin(), dataset_.end(), std::back_inserter(result),
+                [&circle](const Point& p) { return circle.Contains(p); });
+    }
+
+    void reportPolygon(const std::vector<Point>& vertices, std::vector<Point>& result) override {
+        const ConvexPolygon<Point> polygon(vertices);
+        std::copy_if(dataset_.begin(), dataset_.end(), std::back_inserter(result),
+                [&polygon](const Point& p) { return polygon.Contains(p); });
+    }
+
+    void reportNearest(const Point& center, size_t k, std::vector<Point>& result) override {
+        auto distance = [&center](const Point& p) {
+            return (p[0] - center[0]) * (p[0] - center[0]) + (p[1] - center[1]) * (p[1] - center[1]);
+        };
+        std::vector<Point> nearest(dataset_);
+        k = std::min(k, nearest.size());
+        std::partial_sort(nearest.begin(), nearest.begin() + k, nearest.end(),
+                [&distance](const Point& a, const Point& b) { return distance(a) < distance(b); });
+        result.insert(result.end(), nearest.begin(), nearest.begin() + k);
+    }
+
+    Aggregate aggregateRange(const Point& min, const Point& max) override {
+        if (!weighted_)
+            return RangeSearch<Point>::aggregateRange(min, max);
+        Aggregate result;
+        for (size_t i = 0; i < dataset_.size(); ++i) {
+            const Point& p = dataset_[i];
+            if (min[0] <= p[0] && p[0] <= max[0] && min[1] <= p[1] && p[1] <= max[1])
+                result.add(weights_[i]);
+        }
+        return result;
+    }
+
  private:
     std::vector<Point> dataset_;
+    /// Parallel to dataset_ after assignWeighted, empty otherwise.
+    std::vector<double> weights_;
+    bool weighted_ = false;
 
     template<bool kIsReporting>
     size_t processRange(const Point& min, const Point& max, std::vector<Point>* result) {
@@ -0,0 +1,211 @@
+// vim: tabstop=2 shiftwidth=2 expandtab
+
+#ifndef RANGE_SEARCH_NODE_ARENA_H_
+#define RANGE_SEARCH_NODE_ARENA_H_
+
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace range_search {
+
+
+// Where the nodes of a tree are placed after it has been built, see RPlusTree.
+struct NodePlacement {
+  // Back the nodes with 2 MiB transparent huge pages, so that a traversal touching many nodes
+  // needs fewer dTLB entries.
+  bool huge_pages = false;
+  // NUMA node to bind the nodes' memory to, -1 to leave it to the kernel's default policy.
+  int numa_node = -1;
+
+  bool enabled() const { return huge_pages || numa_node >= 0; }
+};
+
+// NUMA nodes and their CPUs as listed in /sys; a single node 0 with all CPUs where they are not.
+class NumaTopology {
+
+  public:
+  static const NumaTopology& Get() {
+    static const NumaTopology topology;
+    return topology;
+  }
+
+  // Node IDs in ascending order. They need not be contiguous.
+  const std::vector<int>& nodes() const { return nodes_; }
+
+  const std::vector<int>& cpus(size_t node_index) const { return cpus_[node_index]; }
+
+  // Index into nodes() of the node the calling thread is running on.
+  size_t CurrentNodeIndex() const {
+    const int cpu = sched_getcpu();
+    return cpu >= 0 && static_cast<size_t>(cpu) < node_of_cpu_.size() ? node_of_cpu_[cpu] : 0;
+  }
+
+  private:
+  NumaTopology() {
+    std::ifstream online("/sys/devices/system/node/online");
+    std::string list;
+    if (online >> list) {
+      nodes_ = ParseList(list);
+    }
+    for (int node : nodes_) {
+      std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+      list.clear();
+      cpulist >> list;
+      cpus_.push_back(ParseList(list));
+    }
+    if (nodes_.empty()) {
+      nodes_.assign(1, 0);
+      cpus_.assign(1, std::vector<int>());
+      for (int cpu = 0; cpu < sysconf(_SC_NPROCESSORS_CONF); ++cpu) {
+        cpus_[0].push_back(cpu);
+      }
+    }
+    for (size_t i = 0; i < nodes_.size(); ++i) {
+      for (int cpu : cpus_[i]) {
+        if (node_of_cpu_.size() <= static_cast<size_t>(cpu)) {
+          node_of_cpu_.resize(cpu + 1, 0);
+        }
+        node_of_cpu_[cpu] = i;
+      }
+    }
+  }
+
+  // Parse a list like "0-3,8,10-11".
+  static std::vector<int> ParseList(const std::string& list) {
+    std::vector<int> values;
+    std::istringstream in(list);
+    std::string range;
+    while (std::getline(in, range, ',')) {
+      int first, last;
+      const int fields = std::sscanf(range.c_str(), "%d-%d", &first, &last);
+      if (fields == 1) {
+        last = first;
+      } else if (fields != 2) {
+        continue;
+      }
+      for (int value = first; value <= last; ++value) {
+        values.push_back(value);
+      }
+    }
+    return values;
+  }
+
+  std::vector<int> nodes_;
+  std::vector<std::vector<int>> cpus_;
+  std::vector<size_t> node_of_cpu_;
+};
+
+// Memory for the nodes of a tree that is no longer rebuilt: one anonymous mapping, placed as given
+// by a NodePlacement, from which nodes are allocated by bumping a pointer. Nodes are not freed
+// individually; the mapping is released as a whole when the arena is destroyed.
+class NodeArena {
+
+  public:
+  static const size_t kHugePageSize = size_t(2) << 20;
+  static const size_t kAlignment = alignof(std::max_align_t);
+
+  // Size of an allocation of the given number of bytes within the arena.
+  static size_t Rounded(size_t bytes) {
+    return (bytes + kAlignment - 1) / kAlignment * kAlignment;
+  }
+
+  // Room for allocations summing up to bytes (as Rounded).
+  NodeArena(size_t bytes, const NodePlacement& placement) : base_(nullptr), bytes_(bytes), used_(0), bound_(false) {
+    if (placement.huge_pages) {
+      // Huge pages need 2 MiB aligned ranges: map one page more and trim both ends.
+      bytes_ = (bytes_ + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+      char* mapping = Map(bytes_ + kHugePageSize);
+      char* aligned = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(mapping) + kHugePageSize - 1) / kHugePageSize * kHugePageSize);
+      if (aligned != mapping) {
+        munmap(mapping, aligned - mapping);
+      }
+      munmap(aligned + bytes_, mapping + kHugePageSize - aligned);
+      base_ = aligned;
+      madvise(base_, bytes_, MADV_HUGEPAGE);
+    } else {
+      bytes_ = std::max<size_t>(bytes_, 1);
+      base_ = Map(bytes_);
+    }
+    // Bind before the first touch, which is when the pages are allocated.
+    if (placement.numa_node >= 0) {
+      bound_ = Bind(placement.numa_node);
+    }
+  }
+
+  ~NodeArena() {
+    munmap(base_, bytes_);
+  }
+
+  NodeArena(const NodeArena&) = delete;
+  NodeArena& operator=(const NodeArena&) = delete;
+
+  void* Allocate(size_t bytes) {
+    bytes = Rounded(bytes);
+    if (bytes > bytes_ - used_) {
+      throw std::bad_alloc();
+    }
+    void* p = base_ + used_;
+    used_ += bytes;
+    return p;
+  }
+
+  size_t bytes() const { return bytes_; }
+
+  // Whether the memory could be bound to the requested NUMA node.
+  bool bound() const { return bound_; }
+
+  // Bytes of the arena backed by huge pages, as reported by the kernel; 0 if unknown.
+  size_t HugePageBytes() const {
+    std::ifstream smaps("/proc/self/smaps");
+    std::string line;
+    bool in_mapping = false;
+    while (std::getline(smaps, line)) {
+      unsigned long start, end;
+      size_t kib;
+      if (std::sscanf(line.c_str(), "%lx-%lx ", &start, &end) == 2) {
+        in_mapping = start <= reinterpret_cast<uintptr_t>(base_) && reinterpret_cast<uintptr_t>(base_) < end;
+      } else if (in_mapping && std::sscanf(line.c_str(), "AnonHugePages: %zu kB", &kib) == 1) {
+        return kib << 10;
+      }
+    }
+    return 0;
+  }
+
+  private:
+  static char* Map(size_t bytes) {
+    void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    return static_cast<char*>(p);
+  }
+
+  // mbind(2) without depending on libnuma.
+  bool Bind(int node) {
+    const int kMpolBind = 2;
+    const size_t kBitsPerWord = 8 * sizeof(unsigned long);
+    std::vector<unsigned long> mask(node / kBitsPerWord + 1);
+    mask[node / kBitsPerWord] |= 1UL << (node % kBitsPerWord);
+    return syscall(SYS_mbind, base_, bytes_, kMpolBind, mask.data(), mask.size() * kBitsPerWord + 1, 0) == 0;
+  }
+
+  char* base_;
+  size_t bytes_;
+  size_t used_;
+  bool bound_;
+};
+
+}  // namespace range_search
+#endif  // RANGE_SEARCH_NODE_ARENA_H_
@@ -0,0 +1,182 @@
+#ifndef RANGE_SEARCH_PROFILER_H_
+#define RANGE_SEARCH_PROFILER_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace range_search {
+
+/// Hierarchical phase timer for preprocessing. Data structures mark phases
+/// with PROFILE_SCOPE("name"); nested scopes become child phases. The profiler
+/// is disabled by default, in which case a scope costs a single branch.
+/// Re-entering a phase that is already active (e.g. in a recursion) is
+/// attributed to the outermost instance. Every PROFILE_SCOPE remembers the
+/// phase it entered last, so that entering it again under the same parent
+/// takes no lookups. Not thread-safe: profile one thread at a time.
+class Profiler {
+ public:
+    static constexpr size_t kMaxCounters = 8;
+    static constexpr size_t kNone = static_cast<size_t>(-1);
+
+    /// Reads the current values of the hardware counters, if any.
+    using CounterReader = std::function<void(long long*)>;
+
+    struct Phase {
+        std::string name;
+        size_t parent;
+        size_t calls;
+        std::chrono::steady_clock::duration duration;
+        long long counters[kMaxCounters];
+    };
+
+    /// Call site of a PROFILE_SCOPE and the phase it entered last.
+    struct Site {
+        const char* name;
+        size_t generation;
+        size_t parent;
+        size_t phase;
+    };
+
+    class Scope {
+     public:
+        explicit Scope(Site& site)
+            : phase_(Profiler::get().enabled_ ? Profiler::get().enter(site) : kNone) {}
+        ~Scope() {
+            if (phase_ != kNone) Profiler::get().leave(phase_);
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+     private:
+        size_t phase_;
+    };
+
+    static Profiler& get() {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    /// Clears all phases and starts profiling, optionally reading num_counters
+    /// hardware counters on every phase transition.
+    void enable(CounterReader reader = nullptr, size_t num_counters = 0) {
+        phases_.clear();
+        phase_names_.clear();
+        names_.clear();
+        active_names_.clear();
+        stack_.clear();
+        ++generation_;
+        reader_ = std::move(reader);
+        num_counters_ = reader_ ? std::min(num_counters, size_t(kMaxCounters)) : 0;
+        enabled_ = true;
+    }
+
+    bool enabled() const { return enabled_; }
+
+    void disable() {
+        enabled_ = false;
+        reader_ = nullptr;
+    }
+
+    size_t numCounters() const { return num_counters_; }
+
+    /// Phases in order of first entry; every phase comes after its parent.
+    const std::vector<Phase>& phases() const { return phases_; }
+
+    /// Returns the phase names from the root down to the given phase.
+    std::string path(size_t phase, const std::string& sep) const {
+        std::string result = phases_[phase].name;
+        for (size_t p = phases_[phase].parent; p != kNone; p = phases_[p].parent)
+            result = phases_[p].name + sep + result;
+        return result;
+    }
+
+ private:
+    struct ActivePhase {
+        size_t phase;
+        std::chrono::steady_clock::time_point start;
+        long long counters[kMaxCounters];
+    };
+
+    Profiler() = default;
+
+    size_t enter(Site& site) {
+        const size_t parent = stack_.empty() ? kNone : stack_.back().phase;
+        if (site.generation != generation_ || site.parent != parent) {
+            const size_t name = nameIndex(site.name);
+            if (active_names_[name])
+                return kNone;
+            size_t phase = 0;
+            while (phase < phases_.size() && (phases_[phase].parent != parent || phase_names_[phase] != name))
+                ++phase;
+            if (phase == phases_.size()) {
+                phases_.push_back({site.name, parent, 0, std::chrono::steady_clock::duration::zero(), {}});
+                phase_names_.push_back(name);
+            }
+            site = {site.name, generation_, parent, phase};
+        } else if (active_names_[phase_names_[site.phase]]) {
+            return kNone;
+        }
+
+        ++active_names_[phase_names_[site.phase]];
+        stack_.emplace_back();
+        stack_.back().phase = site.phase;
+        if (num_counters_) reader_(stack_.back().counters);
+        stack_.back().start = std::chrono::steady_clock::now();
+        return site.phase;
+    }
+
+    /// Index of name in names_, added if new.
+    size_t nameIndex(const char* name) {
+        size_t i = 0;
+        while (i < names_.size() && names_[i] != name)
+            ++i;
+        if (i == names_.size()) {
+            names_.push_back(name);
+            active_names_.push_back(0);
+        }
+        return i;
+    }
+
+    void leave(size_t phase) {
+        const auto now = std::chrono::steady_clock::now();
+        long long counters[kMaxCounters];
+        if (num_counters_) reader_(counters);
+
+        const ActivePhase& active = stack_.back();
+        Phase& p = phases_[phase];
+        ++p.calls;
+        p.duration += now - active.start;
+        for (size_t i = 0; i < num_counters_; ++i)
+            p.counters[i] += counters[i] - active.counters[i];
+        --active_names_[phase_names_[phase]];
+        stack_.pop_back();
+    }
+
+    bool enabled_ = false;
+    CounterReader reader_;
+    size_t num_counters_ = 0;
+    std::vector<Phase> phases_;
+    /// Index into names_ of every phase's name.
+    std::vector<size_t> phase_names_;
+    std::vector<std::string> names_;
+    /// Number of active phases per name.
+    std::vector<size_t> active_names_;
+    std::vector<ActivePhase> stack_;
+    /// Incremented by enable, invalidates the phases remembered by the sites.
+    size_t generation_ = 0;
+};
+
+}  // namespace range_search
+
+#define PROFILE_SCOPE_CONCAT_(a, b) a##b
+#define PROFILE_SCOPE_NAME_(line) PROFILE_SCOPE_CONCAT_(profile_scope_, line)
+#define PROFILE_SITE_NAME_(line) PROFILE_SCOPE_CONCAT_(profile_site_, line)
+#define PROFILE_SCOPE(name) \
+    static ::range_search::Profiler::Site PROFILE_SITE_NAME_(__LINE__) = {name, 0, 0, 0}; \
+    ::range_search::Profiler::Scope PROFILE_SCOPE_NAME_(__LINE__)(PROFILE_SITE_NAME_(__LINE__))
+
+#endif  // RANGE_SEARCH_PROFILER_H_
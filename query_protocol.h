@@ -0,0 +1,118 @@
+// vim: tabstop=2 shiftwidth=2 expandtab
+
+#ifndef RANGE_SEARCH_QUERY_PROTOCOL_H_
+#define RANGE_SEARCH_QUERY_PROTOCOL_H_
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "remote_shard.h"
+
+namespace range_search {
+
+
+// Binary protocol of tools/range_server.cpp for two-dimensional points of doubles, in native byte
+// order. Clients may send any number of requests without waiting for responses; every request is
+// answered by one or more responses carrying its id, whose points make up the result in order. The
+// last of them has kLast set. Responses to different requests may arrive in any order, but those of
+// one request are never interleaved with others.
+struct QueryRequest {
+  enum Op : uint32_t { kCount = 1, kReport = 2, kNearest = 3 };
+
+  uint32_t op;
+  uint32_t k;        // kNearest: the number of neighbours.
+  uint64_t id;       // Chosen by the client, echoed in the responses.
+  double min[2];     // Window corners; kNearest: the center in min.
+  double max[2];
+};
+static_assert(sizeof(QueryRequest) == 48, "QueryRequest must not be padded");
+
+struct QueryResponse {
+  enum Flags : uint32_t { kLast = 1, kError = 2 };
+
+  uint64_t id;
+  uint32_t flags;
+  uint32_t num_points;  // Points following this header.
+  uint64_t count;       // kCount: the number of points in the window; otherwise the result's size.
+};
+static_assert(sizeof(QueryResponse) == 24, "QueryResponse must not be padded");
+
+// Address of a range server: a Unix socket path, or a TCP port on the loopback interface.
+struct ServerAddress {
+  std::string socket_path;
+  int port = 0;
+};
+
+// Listen on address. Throws std::runtime_error on failure.
+inline int Listen(const ServerAddress& address) {
+  const int fd = socket(address.port ? AF_INET : AF_UNIX, SOCK_STREAM, 0);
+  int ok = fd >= 0;
+  if (ok && address.port) {
+    const int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    sockaddr_in in;
+    memset(&in, 0, sizeof(in));
+    in.sin_family = AF_INET;
+    in.sin_port = htons(address.port);
+    in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ok = bind(fd, reinterpret_cast<const sockaddr*>(&in), sizeof(in)) == 0;
+  } else if (ok) {
+    sockaddr_un un;
+    memset(&un, 0, sizeof(un));
+    un.sun_family = AF_UNIX;
+    strncpy(un.sun_path, address.socket_path.c_str(), sizeof(un.sun_path) - 1);
+    unlink(un.sun_path);
+    ok = bind(fd, reinterpret_cast<const sockaddr*>(&un), sizeof(un)) == 0;
+  }
+  if (!ok || listen(fd, SOMAXCONN) != 0) {
+    const std::string error = strerror(errno);
+    if (fd >= 0) {
+      close(fd);
+    }
+    throw std::runtime_error("listen: " + error);
+  }
+  return fd;
+}
+
+// Connect to a server listening on address, with Nagle's algorithm off for TCP. Throws
+// std::runtime_error on failure.
+inline int Connect(const ServerAddress& address) {
+  const int fd = socket(address.port ? AF_INET : AF_UNIX, SOCK_STREAM, 0);
+  int ok = fd >= 0;
+  if (ok && address.port) {
+    const int yes = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    sockaddr_in in;
+    memset(&in, 0, sizeof(in));
+    in.sin_family = AF_INET;
+    in.sin_port = htons(address.port);
+    in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ok = connect(fd, reinterpret_cast<const sockaddr*>(&in), sizeof(in)) == 0;
+  } else if (ok) {
+    sockaddr_un un;
+    memset(&un, 0, sizeof(un));
+    un.sun_family = AF_UNIX;
+    strncpy(un.sun_path, address.socket_path.c_str(), sizeof(un.sun_path) - 1);
+    ok = connect(fd, reinterpret_cast<const sockaddr*>(&un), sizeof(un)) == 0;
+  }
+  if (!ok) {
+    const std::string error = strerror(errno);
+    if (fd >= 0) {
+      close(fd);
+    }
+    throw std::runtime_error("connect: " + error);
+  }
+  return fd;
+}
+
+}  // namespace range_search
+#endif  // RANGE_SEARCH_QUERY_PROTOCOL_H_
@@ -1,12 +1,45 @@
 #ifndef RANGE_SEARCH_H_
 #define RANGE_SEARCH_H_
 
+#include <algorithm>
 #include <cstddef>
+#include <limits>
+#include <stdexcept>
+#include <string>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "geometry.h"
+
 namespace range_search {
 
+/// Named values describing a data structure, e.g. its shape or memory footprint.
+using Metrics = std::vector<std::pair<std::string, double>>;
+
+/// Number of points and the sum, minimum and maximum of their weights, see
+/// RangeSearch::aggregateRange. Without points, min is +inf and max is -inf.
+struct Aggregate {
+    size_t count = 0;
+    double sum = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+
+    void add(double weight) {
+        ++count;
+        sum += weight;
+        min = std::min(min, weight);
+        max = std::max(max, weight);
+    }
+
+    void merge(const Aggregate& other) {
+        count += other.count;
+        sum += other.sum;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+    }
+};
+
 template<class Point>
 class RangeSearch {
     static_assert(!std::is_void<
@@ -20,14 +53,88 @@ class RangeSearch {
     /// Sets the underlying set.
     virtual void assign(const std::vector<Point>& points) = 0;
 
+    /// Sets the underlying set from a contiguous range, e.g. a memory-mapped
+    /// file. Override to avoid the copy into a vector.
+    virtual void assign(const Point* begin, const Point* end) {
+        assign(std::vector<Point>(begin, end));
+    }
+
+    /// Sets the underlying set to points with weights (weights[i] belongs to
+    /// begin[i]), see aggregateRange. Optional.
+    virtual void assignWeighted(const Point* begin, const Point* end, const double* weights) {
+        (void)begin;
+        (void)end;
+        (void)weights;
+        throw std::logic_error("weighted points are not supported");
+    }
+
+    /// Removes one occurrence of each point in deletes, then adds inserts,
+    /// without rebuilding from scratch. Points to delete that are not in the
+    /// set are ignored. Optional.
+    virtual void applyDelta(const std::vector<Point>& inserts, const std::vector<Point>& deletes) {
+        (void)inserts;
+        (void)deletes;
+        throw std::logic_error("applyDelta is not supported");
+    }
+
     /// Reports all points within the rectangle given by [min, max].
     virtual void reportRange(const Point& min, const Point& max, std::vector<Point>& result) = 0;
 
+    /// Reports all points within distance radius of center.
+    virtual void reportCircle(const Point& center, double radius, std::vector<Point>& result) {
+        filterBoundingBox(Circle<Point>(center, radius), result);
+    }
+
+    /// Reports all points within the convex polygon with the given vertices
+    /// (at least three, in clockwise or counterclockwise order).
+    virtual void reportPolygon(const std::vector<Point>& vertices, std::vector<Point>& result) {
+        filterBoundingBox(ConvexPolygon<Point>(vertices), result);
+    }
+
+    /// Reports the k points nearest to center (all points if there are
+    /// fewer), in order of increasing distance; ties are broken arbitrarily.
+    /// Optional.
+    virtual void reportNearest(const Point& center, size_t k, std::vector<Point>& result) {
+        (void)center;
+        (void)k;
+        (void)result;
+        throw std::logic_error("nearest neighbour queries are not supported");
+    }
+
     /// Counts all points within the rectangle given by [min, max].
     virtual size_t countRange(const Point& min, const Point& max) {
         return reportRange(min, max).size();
     }
 
+    /// Counts the points within each of num rectangles, counts[i] for
+    /// queries[i]. Override to interleave the independent queries.
+    virtual void countRanges(const std::pair<Point, Point>* queries, size_t num, size_t* counts) {
+        for (size_t i = 0; i < num; ++i)
+            counts[i] = countRange(queries[i].first, queries[i].second);
+    }
+
+    /// Reports the points within each of num rectangles, appending those
+    /// within queries[i] to results[i]. Override to interleave the
+    /// independent queries.
+    virtual void reportRanges(const std::pair<Point, Point>* queries, size_t num, std::vector<Point>* results) {
+        for (size_t i = 0; i < num; ++i)
+            reportRange(queries[i].first, queries[i].second, results[i]);
+    }
+
+    /// Aggregates the weights of all points within the rectangle given by
+    /// [min, max]. Points inserted by applyDelta have weight 0. Optional,
+    /// requires assignWeighted.
+    virtual Aggregate aggregateRange(const Point& min, const Point& max) {
+        (void)min;
+        (void)max;
+        throw std::logic_error("aggregate queries are not supported");
+    }
+
+    /// Describes the data structure built by assign. Optional.
+    virtual Metrics metrics() const {
+        return {};
+    }
+
     /// Alternative interface to reportRange
     std::vector<Point> reportRange(const Point& min, const Point& max) {
         std::vector<Point> vec;
@@ -35,6 +142,17 @@ class RangeSearch {
         return vec;
     }
 
+ protected:
+    /// Reports the points within the shape's bounding box and drops those
+    /// outside the shape; the default for reportCircle and reportPolygon.
+    template<class Shape>
+    void filterBoundingBox(const Shape& shape, std::vector<Point>& result) {
+        const size_t first = result.size();
+        const auto box = shape.BoundingBox();
+        reportRange(box.bottom_left(), box.top_right(), result);
+        result.erase(std::remove_if(result.begin() + first, result.end(),
+                    [&shape](const Point& p) { return !shape.Contains(p); }), result.end());
+    }
 };
 
 }  // namespace range_search
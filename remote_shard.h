@@ -0,0 +1,315 @@
+// vim: tabstop=2 shiftwidth=2 expandtab
+
+#ifndef RANGE_SEARCH_REMOTE_SHARD_H_
+#define RANGE_SEARCH_REMOTE_SHARD_H_
+
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "range_search.h"
+
+namespace range_search {
+
+
+// Protocol between RemoteShard and ServeShard over a stream socket. Every request is a header
+// followed by its points: the points to assign, the two corners of a query window, the center of a
+// circle or of a nearest neighbour query, or the vertices of a polygon. Every response is a header,
+// followed by the points reported or, for a rejected request, an error message.
+struct ShardRequest {
+  enum Op : uint32_t { kAssign = 1, kCount = 2, kReport = 3, kNearest = 4, kCircle = 5, kPolygon = 6 };
+
+  uint32_t op;
+  uint32_t reserved;
+  uint64_t num_points;
+  uint64_t k;         // kNearest: the number of neighbours.
+  double radius;      // kCircle.
+};
+
+struct ShardResponse {
+  enum Flags : uint32_t { kError = 1 };
+
+  uint32_t flags;
+  uint32_t reserved;
+  uint64_t count;     // kCount: the number of points in the window; kError: the message's length;
+                      // otherwise the number of points following.
+};
+
+// Send or receive exactly n bytes. Throws std::runtime_error if the connection fails or, when
+// receiving, is closed before all bytes arrived; returns false if it is closed before the first.
+inline void SendAll(int fd, const void* data, size_t n) {
+  const char* p = static_cast<const char*>(data);
+  while (n > 0) {
+    const ssize_t sent = send(fd, p, n, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      throw std::runtime_error(std::string("send: ") + strerror(errno));
+    }
+    p += sent;
+    n -= sent;
+  }
+}
+
+inline bool ReceiveAll(int fd, void* data, size_t n) {
+  char* p = static_cast<char*>(data);
+  const size_t total = n;
+  while (n > 0) {
+    const ssize_t received = recv(fd, p, n, 0);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received == 0 && n == total) {
+      return false;
+    }
+    if (received <= 0) {
+      throw std::runtime_error(received == 0 ? std::string("connection closed") : std::string("recv: ") + strerror(errno));
+    }
+    p += received;
+    n -= received;
+  }
+  return true;
+}
+
+// Throw std::invalid_argument unless the request carries num_points points.
+inline void CheckPoints(const ShardRequest& request, uint64_t num_points) {
+  if (request.num_points != num_points) {
+    throw std::invalid_argument("shard request " + std::to_string(request.op) + " needs " + std::to_string(num_points) + " points, got " + std::to_string(request.num_points));
+  }
+}
+
+// Answer the requests arriving on fd with a Tree until the peer closes the connection. Requests
+// with the wrong number of points, of an unknown op or that the tree rejects are answered with an
+// error and leave the shard serving.
+template<class Point, class Tree>
+void ServeShard(int fd) {
+  static_assert(std::is_trivially_copyable<Point>::value, "Points are sent as raw bytes");
+  Tree tree;
+  std::vector<Point> points, result;
+  ShardRequest request;
+  while (ReceiveAll(fd, &request, sizeof(request))) {
+    points.resize(request.num_points);
+    if (!points.empty() && !ReceiveAll(fd, points.data(), points.size() * sizeof(Point))) {
+      throw std::runtime_error("connection closed");
+    }
+    ShardResponse response = {0, 0, 0};
+    result.clear();
+    try {
+      switch (request.op) {
+        case ShardRequest::kAssign:
+          tree.assign(points);
+          break;
+        case ShardRequest::kCount:
+          CheckPoints(request, 2);
+          response.count = tree.countRange(points[0], points[1]);
+          break;
+        case ShardRequest::kReport:
+          CheckPoints(request, 2);
+          tree.reportRange(points[0], points[1], result);
+          break;
+        case ShardRequest::kNearest:
+          CheckPoints(request, 1);
+          tree.reportNearest(points[0], request.k, result);
+          break;
+        case ShardRequest::kCircle:
+          CheckPoints(request, 1);
+          tree.reportCircle(points[0], request.radius, result);
+          break;
+        case ShardRequest::kPolygon:
+          tree.reportPolygon(points, result);
+          break;
+        default:
+          throw std::invalid_argument("unknown shard request " + std::to_string(request.op));
+      }
+    } catch (const std::logic_error& e) {
+      // Covers std::invalid_argument; the request is consumed, so the connection stays in sync.
+      const std::string message = e.what();
+      response = {ShardResponse::kError, 0, message.size()};
+      SendAll(fd, &response, sizeof(response));
+      SendAll(fd, message.data(), message.size());
+      continue;
+    }
+    if (request.op != ShardRequest::kAssign && request.op != ShardRequest::kCount) {
+      response.count = result.size();
+    }
+    SendAll(fd, &response, sizeof(response));
+    SendAll(fd, result.data(), result.size() * sizeof(Point));
+  }
+}
+
+// A shard in another process, which stands in for another machine: either a child process forked
+// by the constructor that serves a Tree over a socket pair, or a server listening on a Unix socket
+// (see tools/shard_server.cpp). Calls are synchronous and must not overlap.
+template<class Point, class Tree>
+class RemoteShard : public RangeSearch<Point> {
+
+  public:
+  // Fork a child process serving a Tree. Fork before starting other threads: only the calling
+  // thread exists in the child.
+  RemoteShard() : fd_(-1), child_(-1) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+      throw std::runtime_error(std::string("socketpair: ") + strerror(errno));
+    }
+    child_ = fork();
+    if (child_ < 0) {
+      close(fds[0]);
+      close(fds[1]);
+      throw std::runtime_error(std::string("fork: ") + strerror(errno));
+    }
+    if (child_ == 0) {
+      // Close the parent's descriptors, including other shards' sockets, so that every child
+      // sees the end of its connection when its RemoteShard closes it.
+      CloseAllBut(fds[1]);
+      int status = 0;
+      try {
+        ServeShard<Point, Tree>(fds[1]);
+      } catch (...) {
+        status = 1;
+      }
+      _exit(status);
+    }
+    close(fds[1]);
+    fd_ = fds[0];
+  }
+
+  // Connect to a server listening on a Unix socket.
+  explicit RemoteShard(const std::string& socket_path) : fd_(socket(AF_UNIX, SOCK_STREAM, 0)), child_(-1) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+      close(fd_);
+      throw std::runtime_error("socket path too long: " + socket_path);
+    }
+    strcpy(address.sun_path, socket_path.c_str());
+    if (fd_ < 0 || connect(fd_, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+      const std::string error = strerror(errno);
+      close(fd_);
+      throw std::runtime_error("connect to " + socket_path + ": " + error);
+    }
+  }
+
+  ~RemoteShard() override {
+    close(fd_);
+    if (child_ > 0) {
+      waitpid(child_, nullptr, 0);
+    }
+  }
+
+  RemoteShard(const RemoteShard&) = delete;
+  RemoteShard& operator=(const RemoteShard&) = delete;
+
+  void assign(const std::vector<Point>& points) override {
+    assign(points.data(), points.data() + points.size());
+  }
+
+  // Returns once the shard has built its tree.
+  void assign(const Point* begin, const Point* end) override {
+    Request({ShardRequest::kAssign, 0, static_cast<uint64_t>(end - begin), 0, 0}, begin);
+  }
+
+  void reportRange(const Point& min, const Point& max, std::vector<Point>& result) override {
+    const Point window[2] = {min, max};
+    Receive(Request({ShardRequest::kReport, 0, 2, 0, 0}, window), result);
+  }
+
+  size_t countRange(const Point& min, const Point& max) override {
+    const Point window[2] = {min, max};
+    return Request({ShardRequest::kCount, 0, 2, 0, 0}, window);
+  }
+
+  void reportNearest(const Point& center, size_t k, std::vector<Point>& result) override {
+    Receive(Request({ShardRequest::kNearest, 0, 1, k, 0}, &center), result);
+  }
+
+  void reportCircle(const Point& center, double radius, std::vector<Point>& result) override {
+    Receive(Request({ShardRequest::kCircle, 0, 1, 0, radius}, &center), result);
+  }
+
+  // Polygons with fewer than three vertices are rejected by the shard, see Request.
+  void reportPolygon(const std::vector<Point>& vertices, std::vector<Point>& result) override {
+    Receive(Request({ShardRequest::kPolygon, 0, vertices.size(), 0, 0}, vertices.data()), result);
+  }
+
+  private:
+  // Close all descriptors from 3 on except keep: with close_range (Linux 5.9), else those listed in
+  // /proc/self/fd, else all up to the descriptor limit.
+  static void CloseAllBut(int keep) {
+#ifdef SYS_close_range
+    const unsigned fd = keep;
+    if ((fd <= 3 || syscall(SYS_close_range, 3u, fd - 1, 0u) == 0) && syscall(SYS_close_range, fd + 1, ~0u, 0u) == 0) {
+      return;
+    }
+#endif
+    DIR* dir = opendir("/proc/self/fd");
+    if (!dir) {
+      for (int i = 3; i < sysconf(_SC_OPEN_MAX); ++i) {
+        if (i != keep) {
+          close(i);
+        }
+      }
+      return;
+    }
+    // Closed after reading the whole directory, which closing would change.
+    std::vector<int> open;
+    while (const dirent* entry = readdir(dir)) {
+      const int i = atoi(entry->d_name);
+      if (i > 2 && i != keep && i != dirfd(dir)) {
+        open.push_back(i);
+      }
+    }
+    closedir(dir);
+    for (int i : open) {
+      close(i);
+    }
+  }
+
+  // Send a request with its request.num_points points and return the count of the response.
+  // Throws std::invalid_argument with the shard's message if it rejected the request.
+  uint64_t Request(const ShardRequest& request, const Point* points) {
+    SendAll(fd_, &request, sizeof(request));
+    SendAll(fd_, points, request.num_points * sizeof(Point));
+    ShardResponse response;
+    if (!ReceiveAll(fd_, &response, sizeof(response))) {
+      throw std::runtime_error("shard closed the connection");
+    }
+    if (response.flags & ShardResponse::kError) {
+      std::string message(response.count, '\0');
+      if (!message.empty() && !ReceiveAll(fd_, &message[0], message.size())) {
+        throw std::runtime_error("shard closed the connection");
+      }
+      throw std::invalid_argument("shard: " + message);
+    }
+    return response.count;
+  }
+
+  // Append the count points following a response to result.
+  void Receive(uint64_t count, std::vector<Point>& result) {
+    const size_t first = result.size();
+    result.resize(first + count);
+    if (count > 0 && !ReceiveAll(fd_, &result[first], count * sizeof(Point))) {
+      result.resize(first);
+      throw std::runtime_error("shard closed the connection");
+    }
+  }
+
+  int fd_;
+  pid_t child_;
+};
+
+}  // namespace range_search
+#endif  // RANGE_SEARCH_REMOTE_SHARD_H_
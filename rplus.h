@@ -5,33 +5,251 @@
 
 #include <iostream>
 #include <limits>
+#include <memory>
+#include <new>
+#include <queue>
 #include <sstream>
+#include <stdexcept>
 #include <algorithm>
+#include <cstdint>
 #include <iomanip>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #define DEBUG 0
 
 #include "range_search.h"
 #include "geometry.h"
+#include "node_arena.h"
+#include "profiler.h"
+#include "traversal_stats.h"
 
 namespace range_search {
 
+template<class Point, size_t leaf_capacity, size_t fanout> class ConcurrentRPlusTree;
 
-template<class Point, size_t node_capacity>
+// Payload of trees that store bare points.
+struct NoPayload { };
+
+// Payload of trees with weighted points, see RPlusTree::aggregateRange.
+struct Weight {
+  double weight;
+};
+
+// Payload of trees of rectangles, see RPlusTree::assignObjects.
+template<class Point>
+struct Extent {
+  Rectangle<Point> extent;
+};
+
+template<class...> struct MakeVoid { using type = void; };
+
+// Whether trees with the payload index rectangles, given by a member extent, rather than points.
+template<class Payload, class = void>
+struct HasExtent : std::false_type { };
+
+template<class Payload>
+struct HasExtent<Payload, typename MakeVoid<decltype(std::declval<Payload>().extent)>::type> : std::true_type { };
+
+// The parts of the summary of the payloads below an inner entry. Each part summarizes one member
+// of the payload and is empty if the payload has no such member.
+
+// Range of the payloads' attribute, used by attribute filters.
+template<class Payload, class = void>
+struct AttributeSummary {
+  void Set(const Payload&) { }
+  void Merge(const AttributeSummary&) { }
+};
+
+template<class Payload>
+struct AttributeSummary<Payload, typename MakeVoid<decltype(std::declval<Payload>().attribute)>::type> {
+  using Attribute = typename std::decay<decltype(std::declval<Payload>().attribute)>::type;
+
+  void Set(const Payload& p) { lo = hi = p.attribute; }
+
+  void Merge(const AttributeSummary& other) {
+    if (other.lo < lo) {
+      lo = other.lo;
+    }
+    if (hi < other.hi) {
+      hi = other.hi;
+    }
+  }
+
+  // Return whether the range intersects [l, h].
+  bool Overlaps(const Attribute& l, const Attribute& h) const { return l <= hi && lo <= h; }
+
+  Attribute lo, hi;
+};
+
+// Aggregate of the payloads' weight, used by aggregate queries.
+template<class Payload, class = void>
+struct WeightSummary {
+  static const bool kEnabled = false;
+
+  void Set(const Payload&) { }
+  void Merge(const WeightSummary&) { }
+};
+
+template<class Payload>
+struct WeightSummary<Payload, typename MakeVoid<decltype(std::declval<Payload>().weight)>::type> {
+  static const bool kEnabled = true;
+
+  void Set(const Payload& p) {
+    weights = Aggregate();
+    weights.add(p.weight);
+  }
+
+  void Merge(const WeightSummary& other) { weights.merge(other.weights); }
+
+  Aggregate weights;
+};
+
+template<class Payload>
+struct PayloadSummary : AttributeSummary<Payload>, WeightSummary<Payload> {
+  void Set(const Payload& p) {
+    AttributeSummary<Payload>::Set(p);
+    WeightSummary<Payload>::Set(p);
+  }
+
+  void Merge(const PayloadSummary& other) {
+    AttributeSummary<Payload>::Merge(other);
+    WeightSummary<Payload>::Merge(other);
+  }
+};
+
+// Payload-dependent part of an RPlusTree entry: the payload in leaf entries, the summary of the
+// payloads below the child in inner entries. Payload must be trivially copyable.
+template<class Payload>
+struct EntryPayload {
+  using Summary = PayloadSummary<Payload>;
+
+  EntryPayload() { }
+
+  union {
+    Payload payload;
+    Summary summary;
+  };
+
+  void SetPayload(const Payload& p) { payload = p; }
+
+  // Return the summary of the payloads at or below the entry.
+  Summary Summarized(bool leaf) const {
+    if (!leaf) {
+      return summary;
+    }
+    Summary s;
+    s.Set(payload);
+    return s;
+  }
+
+  // Return whether the entry's attribute (range) intersects [lo, hi].
+  template<class Attribute>
+  bool AttributeOverlaps(bool leaf, const Attribute& lo, const Attribute& hi) const {
+    return leaf ? lo <= payload.attribute && payload.attribute <= hi : summary.Overlaps(lo, hi);
+  }
+
+  // Set the summary to the one of node's entries.
+  template<class Node>
+  void Summarize(const Node& node) {
+    for (size_t i = 0; i < node.num_entries(); ++i) {
+      if (i == 0) {
+        summary = node.entry(i).Summarized(node.is_leaf());
+      } else {
+        summary.Merge(node.entry(i).Summarized(node.is_leaf()));
+      }
+    }
+  }
+};
+
+// Empty, and as a base class it takes no space.
+template<>
+struct EntryPayload<NoPayload> {
+  void SetPayload(const NoPayload&) { }
+
+  template<class Node>
+  void Summarize(const Node&) { }
+};
+
+// leaf_capacity is the maximum number of points per leaf, fanout the maximum number of children
+// per inner node. Each point can carry a Payload, e.g. a record ID, an attribute that reportRange
+// can filter on and a weight that aggregateRange sums up; without one, equal points are stored once
+// together with their count.
+//
+// With a payload that has a member extent, the tree indexes rectangles instead, see assignObjects.
+// As in the original R+ tree, rectangles straddling a partition boundary are clipped into pieces
+// stored in several leaves; queries report each rectangle from one of its pieces only. The point
+// queries and applyDelta would see the pieces instead and throw std::logic_error on such trees.
+template<class Point, size_t leaf_capacity, size_t fanout = leaf_capacity, class Payload = NoPayload>
 class RPlusTree : public RangeSearch<Point> {
 
-  static const size_t kNodeCapacity = node_capacity;
-  static const size_t kFillFactor = kNodeCapacity * 1;
+  // Publishes path-copied versions of the tree built by Build and ApplyDelta.
+  friend class ConcurrentRPlusTree<Point, leaf_capacity, fanout>;
+
+  static const size_t kLeafCapacity = leaf_capacity;
+  static const size_t kFanout = fanout;
+  static const size_t kLeafFillFactor = kLeafCapacity * 1;
+  static const size_t kFanoutFillFactor = kFanout * 1;
+  static const bool kHasPayload = !std::is_same<Payload, NoPayload>::value;
+  // Queries countRanges and reportRanges keep in flight at a time, and the bytes of a node
+  // prefetched when a query reaches it.
+  static const size_t kInterleavedQueries = 8;
+  static const size_t kPrefetchBytes = 256;
+  using HasWeights = std::integral_constant<bool, WeightSummary<Payload>::kEnabled>;
+
+  public:
+  // A point and its payload.
+  using Record = std::pair<Point, Payload>;
+
+  // Shape and footprint of a tree, see stats(). Levels are counted from the root (level 0).
+  struct Stats {
+    static const size_t kFillBuckets = 10;
+
+    size_t height = 0;
+    // Points including duplicates, and distinct points (leaf entries). Pieces of rectangles in trees
+    // of rectangles.
+    size_t points = 0;
+    size_t distinct_points = 0;
+    size_t nodes = 0;
+    std::vector<size_t> nodes_per_level;
+    // Number of nodes whose fill factor (entries / leaf capacity or fanout) lies in [i / kFillBuckets, (i + 1) / kFillBuckets).
+    size_t fill_histogram[kFillBuckets] = {};
+    double fill_min = 0, fill_avg = 0, fill_max = 0;
+    // Fraction of the nodes' area not covered by their entries' bounding boxes.
+    double dead_space = 0;
+    std::vector<double> dead_space_per_level;
+    // Total area shared by bounding boxes of sibling entries. Zero for a proper R+ tree.
+    double sibling_overlap = 0;
+    // Number of nodes Partition had to split because they straddled a cutline.
+    size_t partition_splits = 0;
+    size_t bytes = 0;
+    double bytes_per_point = 0;
+  };
 
+  private:
   // Forward declaration required for struct Entry.
   class Node;
 
-  // An entry in the tree consists of a child node pointer and its bounding box.
-  struct Entry {
+  // An entry in the tree consists of a child node pointer and its bounding box. Entries of leaves
+  // hold a point instead, as a degenerate bounding box, and the number of times it occurs in the set
+  // (always 1 with a payload). In trees of rectangles, they hold a piece of a rectangle, whose full
+  // extent is in the payload.
+  struct Entry : EntryPayload<Payload> {
     Entry() { }
     Entry(Node* n, const Rectangle<Point>& r) : node(n), rectangle(r) { }
+    Entry(const Point& p, size_t c, const Payload& payload = Payload()) : count(c), rectangle(p, p) {
+      this->SetPayload(payload);
+    }
+    Entry(const Rectangle<Point>& piece, const Payload& payload) : count(1), rectangle(piece) {
+      this->SetPayload(payload);
+    }
 
-    Node* node;
+    union {
+      Node* node;
+      size_t count;
+    };
     Rectangle<Point> rectangle;
   };
 
@@ -40,22 +258,21 @@ class RPlusTree : public RangeSearch<Point> {
   //
 
   // Region with the smallest area is preferred.
-  static double TotalAreaCost(const std::vector<Entry>& entries_sorted, size_t num_used, Axis axis, double cutline) {
+  static double TotalAreaCost(const Entry* entries_sorted, size_t num_used, Axis axis, double cutline) {
     // Unused arguments
     (void)axis;
     (void)cutline;
 
     // Cost: total area around the points
-    std::vector<Point> points;
-    for (size_t i = 0; i < num_used; ++i) {
-      points.push_back(entries_sorted[i].rectangle.bottom_left());
-      points.push_back(entries_sorted[i].rectangle.top_right());
+    Rectangle<Point> box = entries_sorted[0].rectangle;
+    for (size_t i = 1; i < num_used; ++i) {
+      box.Extend(entries_sorted[i].rectangle);
     }
-    return Rectangle<Point>::BoundingBox(points).Area();
+    return box.Area();
   }
 
   // Region that requires the least number of rectangle splits is preferred.
-  static double NumRectangleCuts(const std::vector<Entry>& entries_sorted, size_t num_used, Axis axis, double cutline) {
+  static double NumRectangleCuts(const Entry* entries_sorted, size_t num_used, Axis axis, double cutline) {
     double num_splits = 0;
     for (size_t i = 0; i < num_used; ++i) {
       num_splits += entries_sorted[i].rectangle.Intersects(axis, cutline);
@@ -66,82 +283,415 @@ class RPlusTree : public RangeSearch<Point> {
   // See comment in Sweep(). No function pointers for performance reasons.
   #define COST TotalAreaCost
 
-  // Nodes of the tree.
+  // Nodes of the tree. A node's entries are stored inline directly behind it, in a block sized to
+  // the number of entries it is created with, so a node split or packed from a small remainder does
+  // not take the space of a full one.
   class Node {
     public:
-      Node(const std::vector<Entry>& entries) {
+      // Allocate a node holding exactly the given entries.
+      static Node* Create(const std::vector<Entry>& entries, bool leaf) {
         Assert(entries.size() > 0);         // Nodes must always have at least one entry.
-        num_entries_ = entries.size();
-        std::copy(std::begin(entries), std::end(entries), std::begin(entries_));
+        return Create(entries.data(), entries.size(), leaf);
       }
 
-      ~Node() {
-        for (size_t i = 0; i < num_entries_; ++i) {
-          delete entries_[i].node;
+      static Node* Create(const Entry* entries, size_t num_entries, bool leaf) {
+        Assert(num_entries > 0);
+        return new (::operator new(Bytes(num_entries))) Node(entries, num_entries, leaf, false);
+      }
+
+      // Allocate a node with room for num_entries entries, to be filled by Append.
+      static Node* Reserve(size_t num_entries, bool leaf) {
+        Assert(num_entries > 0);
+        Node* node = new (::operator new(Bytes(num_entries))) Node(nullptr, 0, leaf, false);
+        node->allocated_entries_ = num_entries;
+        return node;
+      }
+
+      // Copy a subtree into an arena, each node in front of its children.
+      static Node* CopyInto(const Node* node, NodeArena& arena) {
+        Node* copy = new (arena.Allocate(Bytes(node->num_entries_))) Node(node->entries(), node->num_entries_, node->leaf_, true);
+        if (!copy->leaf_) {
+          for (size_t i = 0; i < copy->num_entries_; ++i) {
+            copy->entries()[i].node = CopyInto(node->entries()[i].node, arena);
+          }
+        }
+        return copy;
+      }
+
+      // Arena bytes CopyInto takes for a subtree.
+      static size_t ArenaBytes(const Node* node) {
+        size_t bytes = NodeArena::Rounded(Bytes(node->num_entries_));
+        if (!node->leaf_) {
+          for (size_t i = 0; i < node->num_entries_; ++i) {
+            bytes += ArenaBytes(node->entries()[i].node);
+          }
+        }
+        return bytes;
+      }
+
+      // Free a node but not its children. Nodes in an arena are released with the arena.
+      static void Free(Node* node) {
+        const bool in_arena = node->in_arena_;
+        node->~Node();
+        if (!in_arena) {
+          ::operator delete(node);
+        }
+      }
+
+      // Free a node and its subtree.
+      static void Destroy(Node* node) {
+        if (!node) {
+          return;
+        }
+        if (!node->is_leaf()) {
+          for (size_t i = 0; i < node->num_entries_; ++i) {
+            Destroy(node->entries()[i].node);
+          }
+        }
+        Free(node);
+      }
+
+      // Size of a node with room for num_entries entries.
+      static size_t Bytes(size_t num_entries) {
+        return sizeof(Node) + num_entries * sizeof(Entry);
+      }
+
+      // Size of this node.
+      size_t bytes() const {
+        return Bytes(allocated_entries_);
+      }
+
+      // Start loading the node header and its first entries into the cache, without waiting for
+      // them; the node may not be read before it is visited.
+      void Prefetch() const {
+        const char* bytes = reinterpret_cast<const char*>(this);
+        for (size_t offset = 0; offset < kPrefetchBytes; offset += 64) {
+          __builtin_prefetch(bytes + offset);
         }
       }
 
       // Return whether this node is a leaf.
       bool is_leaf() const {
-        return entries_[0].node == nullptr;
+        return leaf_;
+      }
+
+      size_t num_entries() const {
+        return num_entries_;
+      }
+
+      const Entry& entry(size_t i) const {
+        return entries()[i];
+      }
+
+      // Append this node and all nodes below it.
+      void CollectNodes(std::vector<Node*>& nodes) {
+        nodes.push_back(this);
+        if (!is_leaf()) {
+          for (size_t i = 0; i < num_entries_; ++i) {
+            entries()[i].node->CollectNodes(nodes);
+          }
+        }
+      }
+
+      // Append the entries of all leaves below this node.
+      void CollectPoints(std::vector<Entry>& points) const {
+        if (is_leaf()) {
+          points.insert(points.end(), entries(), entries() + num_entries_);
+        } else {
+          for (size_t i = 0; i < num_entries_; ++i) {
+            entries()[i].node->CollectPoints(points);
+          }
+        }
+      }
+
+      // Return the index of the child a new point should go to: one whose bounding box contains it,
+      // or else the one whose bounding box grows least.
+      size_t ChooseChild(const Point& p) const {
+        size_t best = 0;
+        double best_growth = std::numeric_limits<double>::max();
+        for (size_t i = 0; i < num_entries_; ++i) {
+          const Rectangle<Point>& r = entries()[i].rectangle;
+          if (r.Contains(p)) {
+            return i;
+          }
+          Rectangle<Point> grown(Point{{std::min(r.min_side(Axis::X), p[0]), std::min(r.min_side(Axis::Y), p[1])}},
+                                 Point{{std::max(r.max_side(Axis::X), p[0]), std::max(r.max_side(Axis::Y), p[1])}});
+          double growth = grown.Area() - r.Area();
+          if (growth < best_growth) {
+            best = i;
+            best_growth = growth;
+          }
+        }
+        return best;
       }
 
       // Compute the bounding box for all entries of this node.
       Rectangle<Point> ComputeBoundingBox() const {
-        std::vector<Point> points;
-        for (size_t i = 0; i < num_entries_; ++i) {
-          points.push_back(entries_[i].rectangle.bottom_left());
-          points.push_back(entries_[i].rectangle.top_right());
+        Rectangle<Point> box = entries()[0].rectangle;
+        for (size_t i = 1; i < num_entries_; ++i) {
+          box.Extend(entries()[i].rectangle);
         }
-        return Rectangle<Point>::BoundingBox(points);
+        return box;
       }
 
       // Recursively (if !is_leaf) search for all entries covered by this node that
       // overlap with the given search window.
       void Search(const Rectangle<Point>& search_window, std::vector<Point>& result) const {
+        TRAVERSAL_STAT(TraversalStats::NodeVisit visit;)
+        TRAVERSAL_STAT(auto& stats = TraversalStats::get();)
+        bool leaf = is_leaf();
+        for (size_t i = 0; i < num_entries_; ++i) {
+          TRAVERSAL_STAT(++stats.entries_tested;)
+          if (search_window.Overlaps(entries()[i].rectangle)) {
+            if (leaf) {
+              result.insert(result.end(), entries()[i].count, entries()[i].rectangle.bottom_left());
+              TRAVERSAL_STAT(stats.points_reported += entries()[i].count;)
+            } else {
+              TRAVERSAL_STAT(const size_t reported = stats.points_reported;)
+              entries()[i].node->Search(search_window, result);
+              TRAVERSAL_STAT(stats.empty_subtrees += stats.points_reported == reported;)
+            }
+          }
+        }
+      }
+
+      // Like Search, but for a Circle or ConvexPolygon. Subtrees inside the shape are reported
+      // without testing their entries.
+      template<class Shape>
+      void SearchShape(const Shape& shape, std::vector<Point>& result) const {
+        TRAVERSAL_STAT(TraversalStats::NodeVisit visit;)
+        TRAVERSAL_STAT(auto& stats = TraversalStats::get();)
+        bool leaf = is_leaf();
+        for (size_t i = 0; i < num_entries_; ++i) {
+          TRAVERSAL_STAT(++stats.entries_tested;)
+          const Entry& entry = entries()[i];
+          if (leaf) {
+            if (shape.Contains(entry.rectangle.bottom_left())) {
+              result.insert(result.end(), entry.count, entry.rectangle.bottom_left());
+              TRAVERSAL_STAT(stats.points_reported += entry.count;)
+            }
+            continue;
+          }
+          switch (shape.Classify(entry.rectangle)) {
+            case Coverage::kDisjoint:
+              break;
+            case Coverage::kContained:
+              entry.node->ReportAll(result);
+              break;
+            case Coverage::kPartial: {
+              TRAVERSAL_STAT(const size_t reported = stats.points_reported;)
+              entry.node->SearchShape(shape, result);
+              TRAVERSAL_STAT(stats.empty_subtrees += stats.points_reported == reported;)
+              break;
+            }
+          }
+        }
+      }
+
+      // Report all points below this node.
+      void ReportAll(std::vector<Point>& result) const {
+        TRAVERSAL_STAT(TraversalStats::NodeVisit visit;)
+        for (size_t i = 0; i < num_entries_; ++i) {
+          if (is_leaf()) {
+            result.insert(result.end(), entries()[i].count, entries()[i].rectangle.bottom_left());
+            TRAVERSAL_STAT(TraversalStats::get().points_reported += entries()[i].count;)
+          } else {
+            entries()[i].node->ReportAll(result);
+          }
+        }
+      }
+
+      // Like Search, but report records and also skip entries whose attributes lie outside [lo, hi].
+      template<class Attribute>
+      void Search(const Rectangle<Point>& search_window, const Attribute& lo, const Attribute& hi, std::vector<Record>& result) const {
+        TRAVERSAL_STAT(TraversalStats::NodeVisit visit;)
+        TRAVERSAL_STAT(auto& stats = TraversalStats::get();)
+        bool leaf = is_leaf();
+        for (size_t i = 0; i < num_entries_; ++i) {
+          TRAVERSAL_STAT(++stats.entries_tested;)
+          const Entry& entry = entries()[i];
+          if (entry.AttributeOverlaps(leaf, lo, hi) && search_window.Overlaps(entry.rectangle)) {
+            if (leaf) {
+              result.emplace_back(entry.rectangle.bottom_left(), entry.payload);
+              TRAVERSAL_STAT(++stats.points_reported;)
+            } else {
+              TRAVERSAL_STAT(const size_t reported = stats.points_reported;)
+              entry.node->Search(search_window, lo, hi, result);
+              TRAVERSAL_STAT(stats.empty_subtrees += stats.points_reported == reported;)
+            }
+          }
+        }
+      }
+
+      // Like Search, for trees of rectangles: report the payloads of the rectangles overlapping the
+      // search window, each from one of its pieces only (see OwnsReferencePoint).
+      void SearchObjects(const Rectangle<Point>& search_window, std::vector<Payload>& result) const {
+        TRAVERSAL_STAT(TraversalStats::NodeVisit visit;)
+        TRAVERSAL_STAT(auto& stats = TraversalStats::get();)
         bool leaf = is_leaf();
         for (size_t i = 0; i < num_entries_; ++i) {
-          if (search_window.Overlaps(entries_[i].rectangle)) {
+          TRAVERSAL_STAT(++stats.entries_tested;)
+          const Entry& entry = entries()[i];
+          if (!search_window.Overlaps(entry.rectangle)) {
+            continue;
+          }
+          if (!leaf) {
+            entry.node->SearchObjects(search_window, result);
+          } else if (OwnsReferencePoint(entry.rectangle, entry.payload.extent, search_window)) {
+            result.push_back(entry.payload);
+            TRAVERSAL_STAT(++stats.points_reported;)
+          }
+        }
+      }
+
+      // Like Search, but only count the points.
+      size_t Count(const Rectangle<Point>& search_window) const {
+        TRAVERSAL_STAT(TraversalStats::NodeVisit visit;)
+        TRAVERSAL_STAT(auto& stats = TraversalStats::get();)
+        bool leaf = is_leaf();
+        size_t count = 0;
+        for (size_t i = 0; i < num_entries_; ++i) {
+          TRAVERSAL_STAT(++stats.entries_tested;)
+          if (search_window.Overlaps(entries()[i].rectangle)) {
             if (leaf) {
-              result.push_back(entries_[i].rectangle.bottom_left());
+              count += entries()[i].count;
+              TRAVERSAL_STAT(stats.points_reported += entries()[i].count;)
             } else {
-              entries_[i].node->Search(search_window, result);
+              TRAVERSAL_STAT(const size_t reported = stats.points_reported;)
+              count += entries()[i].node->Count(search_window);
+              TRAVERSAL_STAT(stats.empty_subtrees += stats.points_reported == reported;)
             }
           }
         }
+        return count;
       }
 
-      // Split this node along an axis-aligned line. Return a new node containing the entries that are no longer part of this node after the split.
-      // The node's bounding box has to be recalculated after splitting.
-      Node* Split(Axis axis, double offset) {
+      // Like Count, but aggregate the points' weights. Entries inside the search window contribute
+      // the summary of their subtree instead of being descended.
+      void AggregateWeights(const Rectangle<Point>& search_window, Aggregate& result) const {
+        TRAVERSAL_STAT(TraversalStats::NodeVisit visit;)
+        TRAVERSAL_STAT(auto& stats = TraversalStats::get();)
+        bool leaf = is_leaf();
+        for (size_t i = 0; i < num_entries_; ++i) {
+          TRAVERSAL_STAT(++stats.entries_tested;)
+          const Entry& entry = entries()[i];
+          if (!search_window.Overlaps(entry.rectangle)) {
+            continue;
+          }
+          if (leaf) {
+            result.add(entry.payload.weight);
+            TRAVERSAL_STAT(++stats.points_reported;)
+          } else if (search_window.Contains(entry.rectangle)) {
+            result.merge(entry.summary.weights);
+            TRAVERSAL_STAT(stats.points_reported += entry.summary.weights.count;)
+          } else {
+            entry.node->AggregateWeights(search_window, result);
+          }
+        }
+      }
+
+      // Split a node along an axis-aligned line. Return a new node containing the entries that are no longer part of the node after the split.
+      // The node keeps the entries below the line; if they need less room than it has, it is
+      // replaced by a node sized to them. Its bounding box has to be recalculated after splitting.
+      static Node* Split(Node*& node, Axis axis, double offset) {
+        PROFILE_SCOPE("split");
+        Node* abandon = node->SplitEntries(axis, offset);
+        if (node->num_entries_ < node->allocated_entries_) {
+          Node* lower = Create(node->entries(), node->num_entries_, node->leaf_);
+          Free(node);
+          node = lower;
+        }
+        return abandon;
+      }
+
+      // Move the entries above the line into a new node, see Split.
+      Node* SplitEntries(Axis axis, double offset) {
         Assert(num_entries_ > 0);
-        std::vector<Entry> abandon;
+        // Every entry reaching above the line leaves one entry for the new node: itself, its upper
+        // piece or the upper part of its subtree.
+        size_t num_abandoned = 0;
+        for (size_t i = 0; i < num_entries_; ++i) {
+          num_abandoned += entries()[i].rectangle.max_side(axis) > offset;
+        }
+        Node* abandon = Reserve(num_abandoned, is_leaf());
 
         size_t new_num_entries = 0;
         for (size_t i = 0; i < num_entries_; ++i) {
-          Entry& entry = entries_[i];
+          Entry& entry = entries()[i];
           if (entry.rectangle.max_side(axis) <= offset) {
-            entries_[new_num_entries++] = entry;
+            entries()[new_num_entries++] = entry;
           } else if (entry.rectangle.min_side(axis) < offset) {
-            Assert(!is_leaf());               // Currently cannot happen since we only store points in the leaves.
+            if (is_leaf()) {
+              // Only in trees of rectangles.
+              abandon->Append(Clip(entry, axis, offset));
+              entries()[new_num_entries++] = entry;
+              continue;
+            }
 
             // Need to split the child node.
-            Node* new_node = entry.node->Split(axis, offset);
+            Node* new_node = Split(entry.node, axis, offset);
 
             // The original node will now contain all entries "smaller" than the split line. Its bounding box has to be recomputed though.
-            entries_[new_num_entries].node = entry.node;
-            entries_[new_num_entries++].rectangle = entry.node->ComputeBoundingBox();
+            entries()[new_num_entries++] = EntryFor(entry.node);
 
             // The new node will contain all other entries, so "abandon" it.
-            abandon.emplace_back(new_node, new_node->ComputeBoundingBox());
+            abandon->Append(EntryFor(new_node));
           } else {
-            abandon.push_back(entry);
+            abandon->Append(entry);
           }
         }
 
         num_entries_ = new_num_entries;
 
-        return new Node(abandon);
+        return abandon;
+      }
+
+      // Add this node and its subtree to the statistics. node_area and covered_area accumulate the
+      // area of the nodes and of their entries per level.
+      void CollectStats(size_t level, Stats& stats, std::vector<double>& node_area, std::vector<double>& covered_area) const {
+        if (stats.nodes_per_level.size() <= level) {
+          stats.nodes_per_level.resize(level + 1, 0);
+          node_area.resize(level + 1, 0);
+          covered_area.resize(level + 1, 0);
+        }
+        ++stats.nodes;
+        ++stats.nodes_per_level[level];
+        stats.bytes += bytes();
+
+        double fill = static_cast<double>(num_entries_) / (is_leaf() ? kLeafCapacity : kFanout);
+        ++stats.fill_histogram[std::min(static_cast<size_t>(fill * Stats::kFillBuckets), Stats::kFillBuckets - 1)];
+        stats.fill_min = std::min(stats.fill_min, fill);
+        stats.fill_max = std::max(stats.fill_max, fill);
+        stats.fill_avg += fill;
+
+        node_area[level] += ComputeBoundingBox().Area();
+
+        // Sweep over the entries in x order to find overlapping siblings.
+        std::vector<const Rectangle<Point>*> sorted;
+        for (size_t i = 0; i < num_entries_; ++i) {
+          sorted.push_back(&entries()[i].rectangle);
+          covered_area[level] += entries()[i].rectangle.Area();
+        }
+        std::sort(sorted.begin(), sorted.end(), [](const Rectangle<Point>* a, const Rectangle<Point>* b) { return a->min_side(Axis::X) < b->min_side(Axis::X); });
+        for (size_t i = 0; i < sorted.size(); ++i) {
+          for (size_t j = i + 1; j < sorted.size() && sorted[j]->min_side(Axis::X) < sorted[i]->max_side(Axis::X); ++j) {
+            double overlap = sorted[i]->OverlapArea(*sorted[j]);
+            stats.sibling_overlap += overlap;
+            covered_area[level] -= overlap;
+          }
+        }
+
+        if (is_leaf()) {
+          for (size_t i = 0; i < num_entries_; ++i) {
+            stats.points += entries()[i].count;
+          }
+          stats.distinct_points += num_entries_;
+          stats.height = std::max(stats.height, level + 1);
+        } else {
+          for (size_t i = 0; i < num_entries_; ++i) {
+            entries()[i].node->CollectStats(level + 1, stats, node_area, covered_area);
+          }
+        }
       }
 
       void Print(size_t indent_level) {
@@ -153,49 +703,103 @@ class RPlusTree : public RangeSearch<Point> {
         }
         std::cout << "# [" << num_entries_ << "]  " << ComputeBoundingBox() << std::endl;
 
-        for (size_t i = 0; i < num_entries_; ++i) {
-          Node* child = entries_[i].node;
-          if(child) {
-            entries_[i].node->Print(indent_level + 1);
+        if (!is_leaf()) {
+          for (size_t i = 0; i < num_entries_; ++i) {
+            entries()[i].node->Print(indent_level + 1);
           }
         }
       }
 
     private:
+      void Append(const Entry& entry) {
+        Assert(num_entries_ < allocated_entries_);
+        new (entries() + num_entries_++) Entry(entry);
+      }
+
+      Node(const Entry* entries, size_t num_entries, bool leaf, bool in_arena) : num_entries_(num_entries), allocated_entries_(num_entries), leaf_(leaf), in_arena_(in_arena) {
+        std::uninitialized_copy(entries, entries + num_entries, this->entries());
+      }
+
       // Node entries. Entries are stored inline for improved performance.
-      size_t num_entries_ ;
-      Entry entries_[kNodeCapacity];
+      Entry* entries() { return reinterpret_cast<Entry*>(this + 1); }
+      const Entry* entries() const { return reinterpret_cast<const Entry*>(this + 1); }
+
+      size_t num_entries_;
+      // Narrower than num_entries_ so that the flags fit into the same two words.
+      uint32_t allocated_entries_;
+      bool leaf_;
+      bool in_arena_;
   };
+  static_assert(sizeof(Node) % alignof(Entry) == 0, "Entries following a node must be aligned");
 
   private:
     Node* root_;
+    size_t partition_splits_;
+    NodePlacement placement_;
+    // Holds the nodes built by the last assign if they are placed, see NodePlacement.
+    std::unique_ptr<NodeArena> arena_;
 
-    // Pack a set of entries into a new R+ (sub-)tree.
-    static Node* Pack(std::vector<Entry>& entries) {
-      if (entries.size() <= kFillFactor) {
-        return new Node(entries);
+    // Pack a set of entries into a new R+ (sub-)tree. leaf tells whether the entries are points,
+    // which are packed kLeafFillFactor per node, or nodes, packed kFanoutFillFactor per node. The
+    // levels are built within entries, which is consumed.
+    Node* Pack(std::vector<Entry>& entries, bool leaf) {
+      while (entries.size() > (leaf ? kLeafFillFactor : kFanoutFillFactor)) {
+        PackLevel(entries, leaf);
+        leaf = false;
       }
+      return Allocate(entries.data(), entries.size(), leaf);
+    }
 
-      std::vector<Entry> next_level_entries;
-      std::vector<Entry> remainder;
-      while (entries.size() > 0) {
-        next_level_entries.push_back(Partition(entries, remainder));
-        entries.clear();
-        entries.swap(remainder);
+    // Partition a set of entries into nodes of one level and replace them by the entries for these
+    // nodes. Partition works on the suffix of entries not packed yet and the nodes are written to the
+    // prefix already packed, so that no level needs a buffer of its own. Entries between the two
+    // are consumed and make room for the upper parts Partition appends. The bounding boxes of the
+    // level's nodes are computed afterwards in one pass, which the profiler times as a whole: a
+    // scope per node would cost more than the few entries it covers.
+    void PackLevel(std::vector<Entry>& entries, bool leaf) {
+      size_t num_nodes = 0;
+      for (size_t first = 0; first < entries.size();) {
+        Node* node = Partition(entries, num_nodes, first, leaf);
+        // Partition has consumed at least one entry, so this does not overwrite unpacked ones.
+        entries[num_nodes++].node = node;
+      }
+      entries.resize(num_nodes);
+      PROFILE_SCOPE("bbox");
+      for (Entry& entry : entries) {
+        entry = EntryFor(entry.node);
       }
-
-      return Pack(next_level_entries);
     }
 
-    static Entry Partition(std::vector<Entry>& set, std::vector<Entry>& remainder) {
-      if (set.size() <= kFillFactor) {
-        Node* node = new Node(set);
-        return Entry(node, node->ComputeBoundingBox());
+    // Pack a node from the entries at first and behind, move first behind the entries it took and
+    // return it. Entries clipped or split by the cutline leave their upper part at the end of
+    // entries. If the buffer has no room left for them, the entries at first and behind are moved
+    // down to packed first, over the consumed ones, rather than letting the buffer grow.
+    Node* Partition(std::vector<Entry>& entries, size_t packed, size_t& first, bool leaf) {
+      PROFILE_SCOPE("partition");
+      const size_t fill_factor = leaf ? kLeafFillFactor : kFanoutFillFactor;
+      const size_t size = entries.size() - first;
+      Entry* set = entries.data() + first;
+      if (size <= fill_factor) {
+        first = entries.size();
+        return Allocate(set, size, leaf);
+      }
+
+      double cutline, cutline_x = 0, cutline_y = 0;
+      double cost_x, cost_y;
+      {
+        PROFILE_SCOPE("sweep");
+        cost_x = Sweep(set, size, Axis::X, fill_factor, cutline_x);
+        cost_y = Sweep(set, size, Axis::Y, fill_factor, cutline_y);
       }
 
-      double cutline, cutline_x, cutline_y;
-      double cost_x = Sweep(set, Axis::X, cutline_x);
-      double cost_y = Sweep(set, Axis::Y, cutline_y);
+      if (cost_x == std::numeric_limits<double>::max() && cost_y == std::numeric_limits<double>::max()) {
+        // No axis-aligned line has between 1 and fill_factor entries below it, as more than
+        // fill_factor entries start on the lowest x as well as on the lowest y coordinate (an L shape
+        // of points). Take the lexicographically smallest entries; the node touches its siblings.
+        std::sort(set, set + size, [](const Entry& a, const Entry& b) { return a.rectangle.bottom_left() < b.rectangle.bottom_left(); });
+        first += fill_factor;
+        return Allocate(set, fill_factor, leaf);
+      }
 
       // Determine cheapest cutline.
       Axis axis;
@@ -207,70 +811,686 @@ class RPlusTree : public RangeSearch<Point> {
         cutline = cutline_y;
       }
 
-      std::vector<Entry> used;
-      for (auto& entry : set) {
+      if (first > packed && entries.size() + size > entries.capacity()
+          && entries.size() + NumRectangleCuts(set, size, axis, cutline) > entries.capacity()) {
+        std::move(entries.begin() + first, entries.end(), entries.begin() + packed);
+        entries.resize(packed + size);
+        first = packed;
+      }
+
+      // Move the entries below the cutline to the front of the set; the upper parts of entries
+      // crossing it go to the end of entries.
+      size_t num_used = 0;
+      for (size_t i = 0; i < size; ++i) {
+        Entry& entry = entries[first + i];
         if (entry.rectangle.Intersects(axis, cutline)) {
-          // Need to split the node and add the newly created node to the remainder set.
-          Assert(entry.node->ComputeBoundingBox() == entry.rectangle);
-          Node* new_node = entry.node->Split(axis, cutline);
-          entry.rectangle = entry.node->ComputeBoundingBox();
-          remainder.emplace_back(new_node, new_node->ComputeBoundingBox());
+          Entry upper;
+          if (leaf) {
+            // A rectangle, clip it.
+            upper = Clip(entry, axis, cutline);
+          } else {
+            // Need to split the node.
+            Assert(entry.node->ComputeBoundingBox() == entry.rectangle);
+            Node* new_node = Node::Split(entry.node, axis, cutline);
+            ++partition_splits_;
+            entry = EntryFor(entry.node);
+            upper = EntryFor(new_node);
+          }
+          entries.push_back(upper);
+        }
+
+        if (entries[first + i].rectangle.min_side(axis) < cutline) {
+          std::swap(entries[first + i], entries[first + num_used++]);
+        }
+      }
+
+      Node* node = Allocate(entries.data() + first, num_used, leaf);
+      first += num_used;
+      return node;
+    }
+
+    // Pack points into a new tree, nullptr if there are none.
+    Node* Build(const Point* begin, const Point* end) {
+      std::vector<Entry> entries;
+      entries.reserve(end - begin);
+      for (const Point* p = begin; p != end; ++p) {
+        entries.emplace_back(*p, 1);
+      }
+      Compress(entries);
+      return entries.empty() ? nullptr : Pack(entries, true);
+    }
+
+    Node* Build(const std::vector<Record>& records) {
+      std::vector<Entry> entries;
+      entries.reserve(records.size());
+      for (const Record& record : records) {
+        entries.emplace_back(record.first, 1, record.second);
+      }
+      Compress(entries);
+      return entries.empty() ? nullptr : Pack(entries, true);
+    }
+
+    // Sort point entries and merge entries of equal points, adding up their counts. Entries with a
+    // payload are only sorted.
+    static void Compress(std::vector<Entry>& entries) {
+      PROFILE_SCOPE("dedup");
+      std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.rectangle.bottom_left() < b.rectangle.bottom_left(); });
+      if (kHasPayload) {
+        return;
+      }
+      size_t num_distinct = 0;
+      for (size_t i = 0; i < entries.size(); ++i) {
+        if (num_distinct > 0 && entries[num_distinct - 1].rectangle.bottom_left() == entries[i].rectangle.bottom_left()) {
+          entries[num_distinct - 1].count += entries[i].count;
+        } else {
+          entries[num_distinct++] = entries[i];
+        }
+      }
+      entries.resize(num_distinct);
+    }
+
+    // Apply changes below node and return the entries replacing it in its parent: none if it became
+    // empty, several if it overflowed. Only leaves that receive changes are repacked, with Partition;
+    // nodes above them that overflow are split like in a B-tree, so all leaves stay on one level.
+    // Nodes on the paths to the changes are replaced rather than modified, so other subtrees can be
+    // shared with the previous version of the tree. Replaced nodes are freed, or appended to retired
+    // if the previous version is still in use. Deletes of points not found below node are appended
+    // to missed.
+    std::vector<Entry> ApplyDelta(Node* node, const std::vector<Point>& inserts, const std::vector<Point>& deletes, std::vector<Node*>* retired, std::vector<Point>& missed) {
+      std::vector<Entry> entries;
+      if (node->is_leaf()) {
+        PROFILE_SCOPE("repack");
+        node->CollectPoints(entries);
+        Release(node, retired);
+        Modify(entries, inserts, deletes, missed);
+        PackLevel(entries, true);
+        return entries;
+      }
+
+      std::vector<std::vector<Point>> child_inserts(node->num_entries()), child_deletes(node->num_entries());
+      for (const Point& p : inserts) {
+        child_inserts[node->ChooseChild(p)].push_back(p);
+      }
+      // Bounding boxes may touch, so a point can lie in the boxes of several children: pass a delete
+      // on to the next candidate only if the previous one did not have the point.
+      auto route_delete = [&](const Point& p, size_t first) {
+        for (size_t i = first; i < node->num_entries(); ++i) {
+          if (node->entry(i).rectangle.Contains(p)) {
+            child_deletes[i].push_back(p);
+            return;
+          }
         }
+        missed.push_back(p);
+      };
+      for (const Point& p : deletes) {
+        route_delete(p, 0);
+      }
 
-        // Insert node into correct set
-        if (entry.rectangle.min_side(axis) < cutline) {
-          used.push_back(entry);
+      for (size_t i = 0; i < node->num_entries(); ++i) {
+        if (child_inserts[i].empty() && child_deletes[i].empty()) {
+          entries.push_back(node->entry(i));
         } else {
-          remainder.push_back(entry);
+          std::vector<Point> child_missed;
+          std::vector<Entry> replaced = ApplyDelta(node->entry(i).node, child_inserts[i], child_deletes[i], retired, child_missed);
+          entries.insert(entries.end(), replaced.begin(), replaced.end());
+          for (const Point& p : child_missed) {
+            route_delete(p, i + 1);
+          }
         }
       }
+      Release(node, retired);
+      return SplitLevel(entries);
+    }
 
-      Node* node = new Node(used);
-      return Entry(node, node->ComputeBoundingBox());
+    // Free a node replaced by ApplyDelta, or retire it.
+    static void Release(Node* node, std::vector<Node*>* retired) {
+      if (retired) {
+        retired->push_back(node);
+      } else {
+        Node::Free(node);
+      }
+    }
+
+    // Remove deletes from and then add inserts to a set of point entries. Each delete removes one
+    // occurrence of the point; deletes of points not in the set are appended to missed.
+    static void Modify(std::vector<Entry>& entries, const std::vector<Point>& inserts, const std::vector<Point>& deletes, std::vector<Point>& missed) {
+      Compress(entries);
+      for (const Point& p : deletes) {
+        auto it = std::lower_bound(entries.begin(), entries.end(), p, [](const Entry& e, const Point& q) { return e.rectangle.bottom_left() < q; });
+        // With payloads, equal points have separate entries.
+        while (it != entries.end() && it->rectangle.bottom_left() == p && it->count == 0) {
+          ++it;
+        }
+        if (it != entries.end() && it->rectangle.bottom_left() == p) {
+          --it->count;
+        } else {
+          missed.push_back(p);
+        }
+      }
+      entries.erase(std::remove_if(entries.begin(), entries.end(), [](const Entry& e) { return e.count == 0; }), entries.end());
+      for (const Point& p : inserts) {
+        entries.emplace_back(p, 1);
+      }
+      Compress(entries);
     }
 
-    static double Sweep(std::vector<Entry>& set, Axis axis, double& cutline) {
-      Assert(set.size() > 0);
+    // Put entries of inner nodes into as few nodes as the fanout allows. Unlike Partition, this never
+    // splits the entries' subtrees, which may be shared; sibling nodes may overlap instead.
+    std::vector<Entry> SplitLevel(std::vector<Entry>& entries) {
+      std::vector<Entry> nodes;
+      if (entries.size() <= kFanout) {
+        if (!entries.empty()) {
+          nodes.push_back(EntryFor(Allocate(entries, false)));
+        }
+        return nodes;
+      }
 
-      std::sort(set.begin(), set.end(), [=](const Entry& a, const Entry& b) -> bool { return a.rectangle.min_side(axis) < b.rectangle.min_side(axis); });
+      // Cut along the longer side of the bounding box into groups of equal size.
+      Rectangle<Point> box = entries[0].rectangle;
+      for (const auto& entry : entries) {
+        box.Extend(entry.rectangle);
+      }
+      Axis axis = box.max_side(Axis::X) - box.min_side(Axis::X) >= box.max_side(Axis::Y) - box.min_side(Axis::Y) ? Axis::X : Axis::Y;
+      std::sort(entries.begin(), entries.end(), [=](const Entry& a, const Entry& b) {
+          return a.rectangle.min_side(axis) + a.rectangle.max_side(axis) < b.rectangle.min_side(axis) + b.rectangle.max_side(axis);
+        });
+      const size_t num_nodes = (entries.size() + kFanout - 1) / kFanout;
+      for (size_t i = 0; i < num_nodes; ++i) {
+        const size_t begin = i * entries.size() / num_nodes, end = (i + 1) * entries.size() / num_nodes;
+        nodes.push_back(EntryFor(Allocate(entries.data() + begin, end - begin, false)));
+      }
+      return nodes;
+    }
 
-      cutline = set[kFillFactor].rectangle.min_side(axis);
+    // Pack points after removing deletes and adding inserts.
+    Node* Repack(std::vector<Entry>& entries, const std::vector<Point>& inserts, const std::vector<Point>& deletes) {
+      std::vector<Point> missed;
+      Modify(entries, inserts, deletes, missed);
+      return entries.empty() ? nullptr : Pack(entries, true);
+    }
 
-      // Check for edge case: all points on an axis-aligned line.
-      if (set[0].rectangle.min_side(axis) == set[set.size() - 1].rectangle.min_side(axis)) {
+    // Apply changes to the tree below root and return its new root.
+    Node* ApplyDeltaToRoot(Node* root, const std::vector<Point>& inserts, const std::vector<Point>& deletes, std::vector<Node*>* retired) {
+      std::vector<Point> missed;
+      std::vector<Entry> entries = ApplyDelta(root, inserts, deletes, retired, missed);
+      // The root overflowed: grow the tree by a level.
+      while (entries.size() > 1) {
+        entries = SplitLevel(entries);
+      }
+      return entries.empty() ? nullptr : entries[0].node;
+    }
+
+    static Node* Allocate(const std::vector<Entry>& entries, bool leaf) {
+      return Allocate(entries.data(), entries.size(), leaf);
+    }
+
+    static Node* Allocate(const Entry* entries, size_t num_entries, bool leaf) {
+      PROFILE_SCOPE("alloc");
+      return Node::Create(entries, num_entries, leaf);
+    }
+
+    // Clip a leaf entry holding a piece of a rectangle to the part below the line and return the
+    // part above it.
+    static Entry Clip(Entry& entry, Axis axis, double offset) {
+      Entry upper = entry;
+      upper.rectangle = entry.rectangle.ClipAbove(axis, offset);
+      entry.rectangle = entry.rectangle.ClipBelow(axis, offset);
+      return upper;
+    }
+
+    // Whether the piece of object is the one to report for the search window: the one holding the
+    // smallest corner of the object's intersection with the window. Pieces of an object only share
+    // sides created by clipping, which belong to the upper piece, so exactly one piece holds it.
+    static bool OwnsReferencePoint(const Rectangle<Point>& piece, const Rectangle<Point>& object, const Rectangle<Point>& search_window) {
+      for (Axis axis : {Axis::X, Axis::Y}) {
+        const double reference = std::max(object.min_side(axis), search_window.min_side(axis));
+        if (reference < piece.min_side(axis) || (reference >= piece.max_side(axis) && piece.max_side(axis) != object.max_side(axis))) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    // The entry referring to a node: its bounding box and the range of attributes below it.
+    static Entry EntryFor(Node* node) {
+      Entry entry(node, node->ComputeBoundingBox());
+      entry.Summarize(*node);
+      return entry;
+    }
+
+    static double Sweep(Entry* set, size_t size, Axis axis, size_t fill_factor, double& cutline) {
+      Assert(size > fill_factor);
+
+      {
+        PROFILE_SCOPE("sort");
+        std::sort(set, set + size, [=](const Entry& a, const Entry& b) -> bool { return a.rectangle.min_side(axis) < b.rectangle.min_side(axis); });
+      }
+
+      // Entries starting on the cutline end up above it, so the cutline has to be where the
+      // coordinate changes. If the first fill_factor + 1 entries start at the same coordinate, e.g.
+      // because all points lie on an axis-aligned line, this axis cannot be cut.
+      size_t num_used = fill_factor;
+      while (num_used > 0 && set[num_used - 1].rectangle.min_side(axis) == set[num_used].rectangle.min_side(axis)) {
+        --num_used;
+      }
+      if (num_used == 0) {
         return std::numeric_limits<double>::max();
       }
+      cutline = set[num_used].rectangle.min_side(axis);
 
       // This should be a template parameter, but that causes issues due to internal linkage of the template arguments...
-      return COST(set, kFillFactor, axis, cutline);
+      PROFILE_SCOPE("cost");
+      return COST(set, num_used, axis, cutline);
     }
 
   public:
-    RPlusTree() : root_(nullptr) { }
+    RPlusTree() : root_(nullptr), partition_splits_(0) { }
+
+    /// Moves the nodes of every tree built by assign into memory placed as given, e.g. backed by
+    /// huge pages. Nodes that applyDelta replaces stay in that memory until the next assign.
+    explicit RPlusTree(const NodePlacement& placement) : root_(nullptr), partition_splits_(0), placement_(placement) { }
 
     ~RPlusTree() override {
-      delete root_;
+      Node::Destroy(root_);
     }
 
     /// Sets the underlying set.
-    // No two points must be equal.
+    // Equal points are stored once, together with the number of times they occur.
     void assign(const std::vector<Point>& points) override {
-      std::vector<Entry> entries(points.size());
-      for (size_t i = 0; i < points.size(); ++i) {
-        const Point& p = points[i];
-        entries[i] = Entry(nullptr, Rectangle<Point>(p, p));
+      assign(points.data(), points.data() + points.size());
+    }
+
+    void assign(const Point* begin, const Point* end) override {
+      PROFILE_SCOPE("pack");
+      Clear();
+      root_ = Build(begin, end);
+      Place();
+    }
+
+    /// Sets the underlying set to points with payloads.
+    void assign(const std::vector<Record>& records) {
+      PROFILE_SCOPE("pack");
+      Clear();
+      root_ = Build(records);
+      Place();
+    }
+
+    /// Sets the underlying set to a copy of other's, placed as given to the constructor, e.g. as
+    /// a replica on another NUMA node. Cheaper than building the tree again.
+    void assignCopy(const RPlusTree& other) {
+      Clear();
+      partition_splits_ = other.partition_splits_;
+      if (other.root_) {
+        PROFILE_SCOPE("place");
+        arena_.reset(new NodeArena(Node::ArenaBytes(other.root_), placement_));
+        root_ = Node::CopyInto(other.root_, *arena_);
+      }
+    }
+
+    /// Sets the underlying set to rectangles, given by the payloads' member extent. Rectangles that
+    /// straddle a partition boundary are clipped into pieces in several leaves, so that sibling
+    /// nodes stay disjoint.
+    void assignObjects(const std::vector<Payload>& objects) {
+      static_assert(HasExtent<Payload>::value, "Rectangles need a payload with a member extent");
+      PROFILE_SCOPE("pack");
+      Clear();
+      std::vector<Entry> entries;
+      entries.reserve(objects.size());
+      for (const Payload& object : objects) {
+        entries.emplace_back(object.extent, object);
+      }
+      Compress(entries);
+      root_ = entries.empty() ? nullptr : Pack(entries, true);
+      Place();
+    }
+
+    /// Inserts and deletes points, repacking only the leaves they fall into. Its cost depends on
+    /// the number of changes and the node sizes, not on the number of points in the tree.
+    // Each delete removes one occurrence of a point, deletes of points not in the set have no effect.
+    // With a payload, inserted points get a default-constructed one.
+    void applyDelta(const std::vector<Point>& inserts, const std::vector<Point>& deletes) override {
+      PROFILE_SCOPE("delta");
+      RejectRectangles("applyDelta");
+      if (!root_) {
+        std::vector<Entry> entries;
+        root_ = Repack(entries, inserts, deletes);
+      } else if (!inserts.empty() || !deletes.empty()) {
+        root_ = ApplyDeltaToRoot(root_, inserts, deletes, nullptr);
       }
-      root_ = Pack(entries);
     }
 
     /// Reports all points within the rectangle given by [min, max].
     void reportRange(const Point& min, const Point& max, std::vector<Point>& result) override {
+      RejectRectangles("reportRange");
+      if (!root_) {
+        return;
+      }
       Rectangle<Point> search_window(min, max);
       root_->Search(search_window, result);
     }
 
+    /// Reports all points within distance radius of center. Subtrees are classified against the
+    /// circle itself, not its bounding box, and those inside it are reported without further tests.
+    void reportCircle(const Point& center, double radius, std::vector<Point>& result) override {
+      RejectRectangles("reportCircle");
+      if (root_) {
+        root_->SearchShape(Circle<Point>(center, radius), result);
+      }
+    }
+
+    /// Like reportCircle, for a convex polygon.
+    void reportPolygon(const std::vector<Point>& vertices, std::vector<Point>& result) override {
+      RejectRectangles("reportPolygon");
+      if (root_) {
+        root_->SearchShape(ConvexPolygon<Point>(vertices), result);
+      }
+    }
+
+    /// Reports the k points nearest to center, in order of increasing distance, see Nearest.
+    void reportNearest(const Point& center, size_t k, std::vector<Point>& result) override {
+      RejectRectangles("reportNearest");
+      Nearest(root_, center, k, result);
+    }
+
+    // With weights, subtrees inside the window are counted from their summaries.
+    size_t countRange(const Point& min, const Point& max) override {
+      RejectRectangles("countRange");
+      if (!root_) {
+        return 0;
+      }
+      return HasWeights::value ? aggregateRange(min, max).count : root_->Count(Rectangle<Point>(min, max));
+    }
+
+    /// Interleaves up to kInterleavedQueries of the queries, see Interleave.
+    void countRanges(const std::pair<Point, Point>* queries, size_t num, size_t* counts) override {
+      RejectRectangles("countRanges");
+      std::fill(counts, counts + num, 0);
+      Interleave(root_, queries, num, [counts](size_t query, const Entry& entry) { counts[query] += entry.count; });
+    }
+
+    /// Interleaves up to kInterleavedQueries of the queries, see Interleave.
+    void reportRanges(const std::pair<Point, Point>* queries, size_t num, std::vector<Point>* results) override {
+      RejectRectangles("reportRanges");
+      Interleave(root_, queries, num, [results](size_t query, const Entry& entry) {
+        results[query].insert(results[query].end(), entry.count, entry.rectangle.bottom_left());
+      });
+    }
+
+    /// Sets the underlying set to points with weights. Payload must have a member weight, its other
+    /// members are value-initialized.
+    void assignWeighted(const Point* begin, const Point* end, const double* weights) override {
+      AssignWeighted(begin, end, weights, HasWeights());
+    }
+
+    /// Aggregates the weights of the points within the rectangle given by [min, max]. Inner entries
+    /// keep the aggregate of the weights below them, so subtrees inside the window are not descended.
+    Aggregate aggregateRange(const Point& min, const Point& max) override {
+      return AggregateRange(min, max, HasWeights());
+    }
+
+    /// Reports the records within the rectangle given by [min, max] whose payload's attribute lies
+    /// in [attr_lo, attr_hi]. Inner nodes keep the range of attributes below each child, so
+    /// subtrees are pruned by attribute as well as by location.
+    template<class Attribute>
+    void reportRange(const Point& min, const Point& max, const Attribute& attr_lo, const Attribute& attr_hi, std::vector<Record>& result) const {
+      static_assert(kHasPayload, "Attribute filters need a payload");
+      static_assert(!HasExtent<Payload>::value, "Trees of rectangles are queried with reportIntersecting");
+      if (root_) {
+        root_->Search(Rectangle<Point>(min, max), attr_lo, attr_hi, result);
+      }
+    }
+
+    /// Reports the payloads of the rectangles overlapping the rectangle given by [min, max], each
+    /// exactly once although it may be clipped into several pieces.
+    void reportIntersecting(const Point& min, const Point& max, std::vector<Payload>& result) const {
+      static_assert(HasExtent<Payload>::value, "Rectangles need a payload with a member extent");
+      if (root_) {
+        root_->SearchObjects(Rectangle<Point>(min, max), result);
+      }
+    }
+
+    /// Reports the payloads of the rectangles containing p, each exactly once.
+    void reportStabbing(const Point& p, std::vector<Payload>& result) const {
+      reportIntersecting(p, p, result);
+    }
+
+    // Compute shape and memory footprint of the tree.
+    Stats stats() const {
+      Stats stats;
+      stats.partition_splits = partition_splits_;
+      stats.bytes = sizeof(*this);
+      if (!root_) {
+        return stats;
+      }
+
+      std::vector<double> node_area, covered_area;
+      stats.fill_min = std::numeric_limits<double>::max();
+      root_->CollectStats(0, stats, node_area, covered_area);
+      stats.fill_avg /= stats.nodes;
+
+      double total_node_area = 0, total_covered_area = 0;
+      for (size_t level = 0; level < node_area.size(); ++level) {
+        stats.dead_space_per_level.push_back(node_area[level] > 0 ? 1 - covered_area[level] / node_area[level] : 0);
+        total_node_area += node_area[level];
+        total_covered_area += covered_area[level];
+      }
+      stats.dead_space = total_node_area > 0 ? 1 - total_covered_area / total_node_area : 0;
+
+      stats.bytes_per_point = stats.points ? static_cast<double>(stats.bytes) / stats.points : 0;
+      return stats;
+    }
+
+    Metrics metrics() const override {
+      Stats s = stats();
+      Metrics m;
+      auto add = [&m](const std::string& name, double value) { m.emplace_back(name, value); };
+      add("height", s.height);
+      add("points", s.points);
+      add("distinct", s.distinct_points);
+      add("nodes", s.nodes);
+      add("fillmin", s.fill_min);
+      add("fillavg", s.fill_avg);
+      add("fillmax", s.fill_max);
+      add("deadspace", s.dead_space);
+      add("overlap", s.sibling_overlap);
+      add("splits", s.partition_splits);
+      add("bytes", s.bytes);
+      add("bpp", s.bytes_per_point);
+      if (arena_) {
+        add("arenabytes", arena_->bytes());
+        add("hugepagebytes", arena_->HugePageBytes());
+        add("numabound", arena_->bound());
+      }
+      for (size_t level = 0; level < s.nodes_per_level.size(); ++level) {
+        add("nodes" + std::to_string(level), s.nodes_per_level[level]);
+        add("deadspace" + std::to_string(level), s.dead_space_per_level[level]);
+      }
+      for (size_t i = 0; i < Stats::kFillBuckets; ++i) {
+        add("fill" + std::to_string(i), s.fill_histogram[i]);
+      }
+      return m;
+    }
+
     void Print() {
-      root_->Print(0);
+      if (root_) {
+        root_->Print(0);
+      }
+    }
+
+  private:
+    // Free the tree and its arena.
+    void Clear() {
+      Node::Destroy(root_);
+      root_ = nullptr;
+      arena_.reset();
+      partition_splits_ = 0;
+    }
+
+    // Move a freshly built tree into an arena according to placement_.
+    void Place() {
+      if (!placement_.enabled() || !root_) {
+        return;
+      }
+      PROFILE_SCOPE("place");
+      std::unique_ptr<NodeArena> arena(new NodeArena(Node::ArenaBytes(root_), placement_));
+      Node* root = Node::CopyInto(root_, *arena);
+      Node::Destroy(root_);
+      root_ = root;
+      arena_ = std::move(arena);
+    }
+
+    // Append the k points below root nearest to center to result. Entries are visited best-first by
+    // the distance of their rectangles, so no subtree farther away than the k-th nearest point is
+    // opened.
+    static void Nearest(const Node* root, const Point& center, size_t k, std::vector<Point>& result) {
+      // Leaf entries are points, all others subtrees.
+      struct Candidate {
+        double distance;
+        const Entry* entry;
+        bool leaf;
+        bool operator>(const Candidate& other) const { return distance > other.distance; }
+      };
+      if (!root || k == 0) {
+        return;
+      }
+      std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> candidates;
+      auto open = [&](const Node* node) {
+        for (size_t i = 0; i < node->num_entries(); ++i) {
+          candidates.push({node->entry(i).rectangle.SquaredDistance(center), &node->entry(i), node->is_leaf()});
+        }
+      };
+      open(root);
+      while (k > 0 && !candidates.empty()) {
+        const Candidate nearest = candidates.top();
+        candidates.pop();
+        if (nearest.leaf) {
+          const size_t count = std::min(k, nearest.entry->count);
+          result.insert(result.end(), count, nearest.entry->rectangle.bottom_left());
+          k -= count;
+        } else {
+          open(nearest.entry->node);
+        }
+      }
+    }
+
+    // Run range queries below root as a group of independent traversals, each with its own stack
+    // of pending nodes, and pass every leaf entry inside queries[i] to visit(i, entry). A traversal
+    // prefetches the children it is going to descend into and then yields to the next one, so that
+    // the cache misses of up to kInterleavedQueries traversals overlap instead of one query
+    // stalling on each node in turn. A finished traversal takes over the next query.
+    //
+    // The traversal statistics match those of Search and Count. Since the traversals do not
+    // recurse, each one tracks the level of its pending nodes, and in statistics builds marks where
+    // a subtree ends on its stack to tell whether the subtree was empty.
+    template<class Visit>
+    static void Interleave(const Node* root, const std::pair<Point, Point>* queries, size_t num, Visit visit) {
+      // A node to visit, or with node == nullptr the end of the subtree above it on the stack,
+      // entered when the query had seen reported points.
+      struct Step {
+        const Node* node;
+        size_t level;
+        size_t reported;
+      };
+      struct Traversal {
+        size_t query;
+        Rectangle<Point> window;
+        std::vector<Step> pending;
+        size_t reported;
+      };
+      if (!root || num == 0) {
+        return;
+      }
+      TRAVERSAL_STAT(auto& stats = TraversalStats::get();)
+      Traversal traversals[kInterleavedQueries];
+      size_t active = 0;
+      size_t next = 0;
+      auto start = [&](Traversal& traversal) {
+        traversal.query = next;
+        traversal.window = Rectangle<Point>(queries[next].first, queries[next].second);
+        traversal.pending.push_back({root, 0, 0});
+        traversal.reported = 0;
+        ++next;
+      };
+      for (; active < kInterleavedQueries && next < num; ++active) {
+        start(traversals[active]);
+      }
+      root->Prefetch();
+      while (active > 0) {
+        for (size_t t = 0; t < active;) {
+          Traversal& traversal = traversals[t];
+          const Step step = traversal.pending.back();
+          traversal.pending.pop_back();
+          if (!step.node) {
+            TRAVERSAL_STAT(stats.empty_subtrees += traversal.reported == step.reported;)
+          } else {
+            const Node* node = step.node;
+            TRAVERSAL_STAT(++stats.nodes_visited[std::min(step.level, TraversalStats::kMaxLevels - 1)];)
+            TRAVERSAL_STAT(if (step.level > 0) traversal.pending.back().reported = traversal.reported;)
+            for (size_t i = 0; i < node->num_entries(); ++i) {
+              const Entry& entry = node->entry(i);
+              TRAVERSAL_STAT(++stats.entries_tested;)
+              if (!traversal.window.Overlaps(entry.rectangle)) {
+                continue;
+              }
+              if (node->is_leaf()) {
+                visit(traversal.query, entry);
+                TRAVERSAL_STAT(stats.points_reported += entry.count;)
+                TRAVERSAL_STAT(traversal.reported += entry.count;)
+              } else {
+                entry.node->Prefetch();
+                if (TraversalStats::kEnabled) {
+                  traversal.pending.push_back({nullptr, 0, 0});
+                }
+                traversal.pending.push_back({entry.node, step.level + 1, 0});
+              }
+            }
+          }
+          if (!traversal.pending.empty()) {
+            ++t;
+          } else if (next < num) {
+            start(traversal);
+            root->Prefetch();
+            ++t;
+          } else {
+            std::swap(traversal, traversals[--active]);
+          }
+        }
+      }
+    }
+
+  private:
+    // Point operations would work on the clipped pieces of a tree of rectangles.
+    static void RejectRectangles(const char* operation) {
+      if (HasExtent<Payload>::value) {
+        throw std::logic_error(std::string(operation) + " is not supported on trees of rectangles");
+      }
+    }
+
+    void AssignWeighted(const Point* begin, const Point* end, const double* weights, std::true_type) {
+      std::vector<Record> records;
+      records.reserve(end - begin);
+      for (; begin != end; ++begin, ++weights) {
+        Payload payload = Payload();
+        payload.weight = *weights;
+        records.emplace_back(*begin, payload);
+      }
+      assign(records);
+    }
+
+    void AssignWeighted(const Point* begin, const Point* end, const double* weights, std::false_type) {
+      RangeSearch<Point>::assignWeighted(begin, end, weights);
+    }
+
+    Aggregate AggregateRange(const Point& min, const Point& max, std::true_type) const {
+      Aggregate result;
+      if (root_) {
+        root_->AggregateWeights(Rectangle<Point>(min, max), result);
+      }
+      return result;
+    }
+
+    Aggregate AggregateRange(const Point& min, const Point& max, std::false_type) {
+      return RangeSearch<Point>::aggregateRange(min, max);
     }
 
 };
@@ -0,0 +1,270 @@
+// vim: tabstop=2 shiftwidth=2 expandtab
+
+#ifndef RANGE_SEARCH_RPLUS_AUTOTUNE_H_
+#define RANGE_SEARCH_RPLUS_AUTOTUNE_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "range_search.h"
+#include "rplus.h"
+
+namespace range_search {
+
+
+// R+ tree that picks its node capacity when the point set is assigned: it packs a sample of the
+// points with every candidate capacity, times query windows centred on sample points and builds the
+// whole tree with the capacity whose estimated query cost on the whole input is lowest.
+//
+// The trees on the sample are smaller and shallower than the final tree, so their query times are
+// not taken as they are. Each candidate is timed twice: on degenerate windows, which only descend
+// to a leaf, and on windows covering the target selectivity's area but at least an eighth of the
+// sample, so that the time spent per point stands out from the timing noise. The estimate scales
+// the descent by the number of levels the final tree will have and the rest, the work per point in
+// the window, by the number of points a window of the target selectivity holds in the whole input.
+// The windows are the same for every input size, so the choice only moves with the input size as
+// far as the estimate does.
+template<class Point>
+class AutoTunedRPlusTree : public RangeSearch<Point> {
+
+  public:
+  // Capacity at which a full node fills one page of the given size (node header: entry counts).
+  template<size_t page_size>
+  struct PageCapacity {
+    static const size_t value = (page_size - 2 * sizeof(size_t)) / (sizeof(void*) + sizeof(Rectangle<Point>));
+  };
+
+  // A candidate capacity, its measurements on the sample and the query time estimated from them.
+  struct Candidate {
+    size_t capacity;
+    std::string description;
+    double build_seconds;
+    double descent_seconds;  // per degenerate window on the sample
+    double window_seconds;   // per window on the sample
+    double query_seconds;    // estimated per window of the target selectivity on the whole input
+  };
+
+  // sample_size points and num_queries windows are used for tuning, for windows covering about
+  // selectivity (a fraction) of the points.
+  explicit AutoTunedRPlusTree(size_t sample_size = 4096, size_t num_queries = 256, double selectivity = 0.001, unsigned seed = 0)
+      : sample_size_(sample_size), num_queries_(num_queries), selectivity_(selectivity), seed_(seed), capacity_(0) { }
+
+  void assign(const std::vector<Point>& points) override {
+    assign(points.data(), points.data() + points.size());
+  }
+
+  void assign(const Point* begin, const Point* end) override {
+    capacity_ = chooseCapacity(begin, end);
+    tree_.reset(Create(capacity_));
+    tree_->assign(begin, end);
+  }
+
+  // Tune for the points without building a tree, see assign. Returns the capacity assign would
+  // choose, one 4 KiB page for fewer than two points, and leaves the measurements in candidates().
+  size_t chooseCapacity(const Point* begin, const Point* end) {
+    candidates_.clear();
+    const size_t n = end - begin;
+    if (n < 2) {
+      return PageCapacity<4096>::value;
+    }
+    PROFILE_SCOPE("tune");
+    Tune(n > sample_size_ ? Sample(begin, end) : std::vector<Point>(begin, end), n);
+    auto best = std::min_element(candidates_.begin(), candidates_.end(), [](const Candidate& a, const Candidate& b) { return a.query_seconds < b.query_seconds; });
+    return best->capacity;
+  }
+
+  // Keeps the capacity chosen by the last assign.
+  void applyDelta(const std::vector<Point>& inserts, const std::vector<Point>& deletes) override {
+    if (!tree_) {
+      assign(inserts);
+    } else {
+      tree_->applyDelta(inserts, deletes);
+    }
+  }
+
+  void reportRange(const Point& min, const Point& max, std::vector<Point>& result) override {
+    if (tree_) {
+      tree_->reportRange(min, max, result);
+    }
+  }
+
+  size_t countRange(const Point& min, const Point& max) override {
+    return tree_ ? tree_->countRange(min, max) : 0;
+  }
+
+  void countRanges(const std::pair<Point, Point>* queries, size_t num, size_t* counts) override {
+    if (tree_) {
+      tree_->countRanges(queries, num, counts);
+    } else {
+      std::fill(counts, counts + num, 0);
+    }
+  }
+
+  void reportRanges(const std::pair<Point, Point>* queries, size_t num, std::vector<Point>* results) override {
+    if (tree_) {
+      tree_->reportRanges(queries, num, results);
+    }
+  }
+
+  void reportCircle(const Point& center, double radius, std::vector<Point>& result) override {
+    if (tree_) {
+      tree_->reportCircle(center, radius, result);
+    }
+  }
+
+  void reportPolygon(const std::vector<Point>& vertices, std::vector<Point>& result) override {
+    if (tree_) {
+      tree_->reportPolygon(vertices, result);
+    }
+  }
+
+  void reportNearest(const Point& center, size_t k, std::vector<Point>& result) override {
+    if (tree_) {
+      tree_->reportNearest(center, k, result);
+    }
+  }
+
+  // The capacity chosen by the last assign (one 4 KiB page for fewer than two points), 0 before.
+  size_t capacity() const { return capacity_; }
+
+  // Measurements of all candidates during the last assign or chooseCapacity.
+  const std::vector<Candidate>& candidates() const { return candidates_; }
+
+  Metrics metrics() const override {
+    Metrics m;
+    if (!tree_) {
+      return m;
+    }
+    m.emplace_back("capacity", static_cast<double>(capacity_));
+    for (const auto& c : candidates_) {
+      m.emplace_back("tune" + std::to_string(c.capacity), c.query_seconds);
+    }
+    for (const auto& metric : tree_->metrics()) {
+      m.push_back(metric);
+    }
+    return m;
+  }
+
+  private:
+  // Fixed capacities of contenders.h plus page-sized nodes.
+  static RangeSearch<Point>* Create(size_t capacity) {
+    switch (capacity) {
+      case 8: return new RPlusTree<Point, 8>;
+      case 16: return new RPlusTree<Point, 16>;
+      case 32: return new RPlusTree<Point, 32>;
+      case 64: return new RPlusTree<Point, 64>;
+      case 128: return new RPlusTree<Point, 128>;
+      case 256: return new RPlusTree<Point, 256>;
+      case PageCapacity<4096>::value: return new RPlusTree<Point, PageCapacity<4096>::value>;
+      case PageCapacity<8192>::value: return new RPlusTree<Point, PageCapacity<8192>::value>;
+      default: return nullptr;
+    }
+  }
+
+  std::vector<Point> Sample(const Point* begin, const Point* end) const {
+    // Reservoir sampling keeps the sample free of duplicates if the input is.
+    std::mt19937_64 rng(seed_);
+    std::vector<Point> sample(begin, begin + sample_size_);
+    for (size_t i = sample_size_; begin + i != end; ++i) {
+      size_t j = std::uniform_int_distribution<size_t>(0, i)(rng);
+      if (j < sample_size_) {
+        sample[j] = begin[i];
+      }
+    }
+    return sample;
+  }
+
+  // Windows centred on sample points, sized by the distance (maximum norm) to the k-th nearest
+  // sample point so that they follow the data's density.
+  std::vector<std::pair<Point, Point>> Queries(const std::vector<Point>& sample, size_t k) const {
+    std::mt19937_64 rng(seed_ + 1);
+    std::uniform_int_distribution<size_t> pick(0, sample.size() - 1);
+    std::vector<double> distances(sample.size());
+    std::vector<std::pair<Point, Point>> queries;
+    for (size_t q = 0; q < num_queries_; ++q) {
+      const Point& centre = sample[pick(rng)];
+      for (size_t i = 0; i < sample.size(); ++i) {
+        distances[i] = std::max(std::abs(sample[i][0] - centre[0]), std::abs(sample[i][1] - centre[1]));
+      }
+      std::nth_element(distances.begin(), distances.begin() + k, distances.end());
+      const double r = distances[k];
+      queries.emplace_back(Point{{centre[0] - r, centre[1] - r}}, Point{{centre[0] + r, centre[1] + r}});
+    }
+    return queries;
+  }
+
+  // Levels of a tree packing num_points points into full nodes of the given capacity.
+  static double Levels(size_t num_points, size_t capacity) {
+    double levels = 1;
+    for (size_t nodes = (num_points + capacity - 1) / capacity; nodes > 1; nodes = (nodes + capacity - 1) / capacity) {
+      ++levels;
+    }
+    return levels;
+  }
+
+  // Seconds per query of reporting and counting the points in every window. Each window is timed
+  // in several rounds and its fastest one counts, which leaves out cold caches and interruptions.
+  static double Time(RangeSearch<Point>& tree, const std::vector<std::pair<Point, Point>>& queries) {
+    using Clock = std::chrono::steady_clock;
+    std::vector<Point> result;
+    std::vector<double> seconds(queries.size(), std::numeric_limits<double>::max());
+    for (int round = 0; round < 5; ++round) {
+      for (size_t i = 0; i < queries.size(); ++i) {
+        const auto start = Clock::now();
+        result.clear();
+        tree.reportRange(queries[i].first, queries[i].second, result);
+        tree.countRange(queries[i].first, queries[i].second);
+        seconds[i] = std::min(seconds[i], std::chrono::duration<double>(Clock::now() - start).count());
+      }
+    }
+    return std::accumulate(seconds.begin(), seconds.end(), 0.0) / queries.size();
+  }
+
+  // Time the windows on the sample for every candidate capacity and estimate their cost on the
+  // n points.
+  void Tune(const std::vector<Point>& sample, size_t n) {
+    using Clock = std::chrono::steady_clock;
+    // Windows holding k of the sample's points cover about the target selectivity's area, or more
+    // for small selectivities. Those of the target selectivity hold selectivity * n of all points.
+    const size_t k = std::min(sample.size() - 1, std::max(sample.size() / 8, static_cast<size_t>(selectivity_ * sample.size())));
+    const double points_scale = std::max(1.0, selectivity_ * n) / k;
+    const auto windows = Queries(sample, k);
+    std::vector<std::pair<Point, Point>> descents;
+    for (const auto& w : windows) {
+      const Point centre = {{(w.first[0] + w.second[0]) / 2, (w.first[1] + w.second[1]) / 2}};
+      descents.emplace_back(centre, centre);
+    }
+    const std::pair<size_t, const char*> capacities[] = {
+      {8, ""}, {16, ""}, {32, ""}, {64, ""}, {128, ""}, {256, ""},
+      {PageCapacity<4096>::value, "4 KiB page"}, {PageCapacity<8192>::value, "two 4 KiB pages"},
+    };
+    for (const auto& capacity : capacities) {
+      std::unique_ptr<RangeSearch<Point>> tree(Create(capacity.first));
+      const auto start = Clock::now();
+      tree->assign(sample);
+      const auto built = Clock::now();
+      const double descent = Time(*tree, descents), window = Time(*tree, windows);
+      const double levels_scale = Levels(n, capacity.first) / Levels(sample.size(), capacity.first);
+      const double estimate = descent * levels_scale + std::max(0.0, window - descent) * points_scale;
+      candidates_.push_back({capacity.first, capacity.second, std::chrono::duration<double>(built - start).count(), descent, window, estimate});
+    }
+  }
+
+  size_t sample_size_;
+  size_t num_queries_;
+  double selectivity_;
+  unsigned seed_;
+  size_t capacity_;
+  std::vector<Candidate> candidates_;
+  std::unique_ptr<RangeSearch<Point>> tree_;
+};
+
+}  // namespace range_search
+#endif  // RANGE_SEARCH_RPLUS_AUTOTUNE_H_
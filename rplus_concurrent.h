@@ -0,0 +1,176 @@
+// vim: tabstop=2 shiftwidth=2 expandtab
+
+#ifndef RANGE_SEARCH_RPLUS_CONCURRENT_H_
+#define RANGE_SEARCH_RPLUS_CONCURRENT_H_
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "epoch.h"
+#include "range_search.h"
+#include "rplus.h"
+
+namespace range_search {
+
+
+// R+ tree whose queries may run concurrently with updates. Every version of the tree is immutable:
+// updates copy the nodes on the paths to their changes (see RPlusTree::ApplyDelta) and publish the
+// new root atomically, readers work on the version that was current when they took their snapshot.
+// Nodes only reachable from old versions are freed by epoch-based reclamation once no snapshot can
+// reach them anymore.
+//
+// reportRange and snapshot may be called from any number of threads; assign and applyDelta are
+// serialized among each other.
+template<class Point, size_t leaf_capacity, size_t fanout = leaf_capacity>
+class ConcurrentRPlusTree : public RangeSearch<Point> {
+
+  using Tree = RPlusTree<Point, leaf_capacity, fanout>;
+  using Node = typename Tree::Node;
+
+  public:
+  // A consistent version of the tree, valid for as long as the snapshot lives.
+  class Snapshot {
+    public:
+    void reportRange(const Point& min, const Point& max, std::vector<Point>& result) const {
+      if (root_) {
+        root_->Search(Rectangle<Point>(min, max), result);
+      }
+    }
+
+    size_t countRange(const Point& min, const Point& max) const {
+      return root_ ? root_->Count(Rectangle<Point>(min, max)) : 0;
+    }
+
+    // See RPlusTree::countRanges.
+    void countRanges(const std::pair<Point, Point>* queries, size_t num, size_t* counts) const {
+      std::fill(counts, counts + num, 0);
+      Tree::Interleave(root_, queries, num, [counts](size_t query, const typename Tree::Entry& entry) { counts[query] += entry.count; });
+    }
+
+    // See RPlusTree::reportRanges.
+    void reportRanges(const std::pair<Point, Point>* queries, size_t num, std::vector<Point>* results) const {
+      Tree::Interleave(root_, queries, num, [results](size_t query, const typename Tree::Entry& entry) {
+        results[query].insert(results[query].end(), entry.count, entry.rectangle.bottom_left());
+      });
+    }
+
+    // See RPlusTree::reportNearest.
+    void reportNearest(const Point& center, size_t k, std::vector<Point>& result) const {
+      Tree::Nearest(root_, center, k, result);
+    }
+
+    // Any shape with Classify and Contains, e.g. Circle or ConvexPolygon.
+    template<class Shape>
+    void reportShape(const Shape& shape, std::vector<Point>& result) const {
+      if (root_) {
+        root_->SearchShape(shape, result);
+      }
+    }
+
+    private:
+    friend class ConcurrentRPlusTree;
+    Snapshot(typename EpochReclaimer<Node>::Guard&& guard, const Node* root) : guard_(std::move(guard)), root_(root) { }
+
+    typename EpochReclaimer<Node>::Guard guard_;
+    const Node* root_;
+  };
+
+  ConcurrentRPlusTree() : root_(nullptr), versions_(0), reclaimer_(&Node::Free) { }
+
+  ~ConcurrentRPlusTree() override {
+    Node::Destroy(root_.load());
+  }
+
+  // Pin the current version.
+  Snapshot snapshot() {
+    auto guard = reclaimer_.Pin();
+    return Snapshot(std::move(guard), root_.load(std::memory_order_acquire));
+  }
+
+  void assign(const std::vector<Point>& points) override {
+    assign(points.data(), points.data() + points.size());
+  }
+
+  void assign(const Point* begin, const Point* end) override {
+    PROFILE_SCOPE("pack");
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    std::vector<Node*> retired;
+    if (Node* old_root = root_.load(std::memory_order_relaxed)) {
+      old_root->CollectNodes(retired);
+    }
+    Publish(builder_.Build(begin, end), retired);
+  }
+
+  // Changes are applied to a copy of the affected paths, see RPlusTree::applyDelta.
+  void applyDelta(const std::vector<Point>& inserts, const std::vector<Point>& deletes) override {
+    PROFILE_SCOPE("delta");
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    Node* root = root_.load(std::memory_order_relaxed);
+    std::vector<Node*> retired;
+    if (!root) {
+      std::vector<typename Tree::Entry> entries;
+      root = builder_.Repack(entries, inserts, deletes);
+    } else if (!inserts.empty() || !deletes.empty()) {
+      root = builder_.ApplyDeltaToRoot(root, inserts, deletes, &retired);
+    }
+    Publish(root, retired);
+  }
+
+  void reportRange(const Point& min, const Point& max, std::vector<Point>& result) override {
+    snapshot().reportRange(min, max, result);
+  }
+
+  size_t countRange(const Point& min, const Point& max) override {
+    return snapshot().countRange(min, max);
+  }
+
+  // All queries of the batch see the same version.
+  void countRanges(const std::pair<Point, Point>* queries, size_t num, size_t* counts) override {
+    snapshot().countRanges(queries, num, counts);
+  }
+
+  void reportRanges(const std::pair<Point, Point>* queries, size_t num, std::vector<Point>* results) override {
+    snapshot().reportRanges(queries, num, results);
+  }
+
+  void reportCircle(const Point& center, double radius, std::vector<Point>& result) override {
+    snapshot().reportShape(Circle<Point>(center, radius), result);
+  }
+
+  void reportPolygon(const std::vector<Point>& vertices, std::vector<Point>& result) override {
+    snapshot().reportShape(ConvexPolygon<Point>(vertices), result);
+  }
+
+  void reportNearest(const Point& center, size_t k, std::vector<Point>& result) override {
+    snapshot().reportNearest(center, k, result);
+  }
+
+  Metrics metrics() const override {
+    Metrics m;
+    m.emplace_back("versions", static_cast<double>(versions_));
+    m.emplace_back("retired", static_cast<double>(reclaimer_.pending()));
+    return m;
+  }
+
+  private:
+  // Make root the current version and retire the nodes only the previous versions use.
+  void Publish(Node* root, const std::vector<Node*>& retired) {
+    root_.store(root);
+    ++versions_;
+    reclaimer_.Retire(retired);
+  }
+
+  // Only used for its packing functions, its own root stays empty.
+  Tree builder_;
+  std::atomic<Node*> root_;
+  std::mutex writer_mutex_;
+  size_t versions_;
+  EpochReclaimer<Node> reclaimer_;
+};
+
+}  // namespace range_search
+#endif  // RANGE_SEARCH_RPLUS_CONCURRENT_H_
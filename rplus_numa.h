@@ -0,0 +1,113 @@
+// vim: tabstop=2 shiftwidth=2 expandtab
+
+#ifndef RANGE_SEARCH_RPLUS_NUMA_H_
+#define RANGE_SEARCH_RPLUS_NUMA_H_
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "node_arena.h"
+#include "range_search.h"
+#include "rplus.h"
+
+namespace range_search {
+
+
+// R+ tree replicated to every NUMA node: assign builds the tree once and copies it into memory
+// bound to each node, and queries run on the replica of the node the calling thread is running on,
+// so that no query reads the tree across the interconnect. Pin query threads to keep them on their
+// node. The replicas are read-only, applyDelta is not supported.
+template<class Point, size_t leaf_capacity, size_t fanout = leaf_capacity>
+class ReplicatedRPlusTree : public RangeSearch<Point> {
+
+  using Tree = RPlusTree<Point, leaf_capacity, fanout>;
+
+  public:
+  // Queries before the first assign find an empty replica.
+  explicit ReplicatedRPlusTree(bool huge_pages = false) : huge_pages_(huge_pages) {
+    replicas_.emplace_back(new Tree);
+  }
+
+  void assign(const std::vector<Point>& points) override {
+    assign(points.data(), points.data() + points.size());
+  }
+
+  void assign(const Point* begin, const Point* end) override {
+    const auto& nodes = NumaTopology::Get().nodes();
+    replicas_.clear();
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      NodePlacement placement;
+      placement.huge_pages = huge_pages_;
+      placement.numa_node = nodes[i];
+      replicas_.emplace_back(new Tree(placement));
+      if (i == 0) {
+        replicas_[0]->assign(begin, end);
+      } else {
+        replicas_[i]->assignCopy(*replicas_[0]);
+      }
+    }
+  }
+
+  void reportRange(const Point& min, const Point& max, std::vector<Point>& result) override {
+    Local().reportRange(min, max, result);
+  }
+
+  size_t countRange(const Point& min, const Point& max) override {
+    return Local().countRange(min, max);
+  }
+
+  void reportCircle(const Point& center, double radius, std::vector<Point>& result) override {
+    Local().reportCircle(center, radius, result);
+  }
+
+  void reportPolygon(const std::vector<Point>& vertices, std::vector<Point>& result) override {
+    Local().reportPolygon(vertices, result);
+  }
+
+  void reportNearest(const Point& center, size_t k, std::vector<Point>& result) override {
+    Local().reportNearest(center, k, result);
+  }
+
+  void countRanges(const std::pair<Point, Point>* queries, size_t num, size_t* counts) override {
+    Local().countRanges(queries, num, counts);
+  }
+
+  void reportRanges(const std::pair<Point, Point>* queries, size_t num, std::vector<Point>* results) override {
+    Local().reportRanges(queries, num, results);
+  }
+
+  // The replica on the i-th node of NumaTopology::nodes().
+  const Tree& replica(size_t i) const { return *replicas_[i]; }
+
+  size_t num_replicas() const { return replicas_.size(); }
+
+  // The first replica's metrics, plus the placement of every replica.
+  Metrics metrics() const override {
+    Metrics m;
+    m.emplace_back("replicas", static_cast<double>(replicas_.size()));
+    for (const auto& metric : replicas_[0]->metrics()) {
+      m.push_back(metric);
+    }
+    for (size_t i = 1; i < replicas_.size(); ++i) {
+      for (const auto& metric : replicas_[i]->metrics()) {
+        if (metric.first == "hugepagebytes" || metric.first == "numabound") {
+          m.emplace_back(metric.first + std::to_string(i), metric.second);
+        }
+      }
+    }
+    return m;
+  }
+
+  private:
+  Tree& Local() {
+    return *replicas_[replicas_.size() > 1 ? NumaTopology::Get().CurrentNodeIndex() : 0];
+  }
+
+  bool huge_pages_;
+  std::vector<std::unique_ptr<Tree>> replicas_;
+};
+
+}  // namespace range_search
+#endif  // RANGE_SEARCH_RPLUS_NUMA_H_
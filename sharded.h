@@ -0,0 +1,294 @@
+// vim: tabstop=2 shiftwidth=2 expandtab
+
+#ifndef RANGE_SEARCH_SHARDED_H_
+#define RANGE_SEARCH_SHARDED_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "geometry.h"
+#include "profiler.h"
+#include "range_search.h"
+#include "traversal_stats.h"
+
+namespace range_search {
+
+
+// Runs groups of independent calls on a fixed set of threads, with the calling thread taking part.
+// Groups from several threads are run one after the other.
+class WorkerPool {
+
+  public:
+  explicit WorkerPool(size_t num_threads) : num_tasks_(0), next_(0), done_(0), task_(nullptr), stop_(false) {
+    for (size_t i = 0; i < num_threads; ++i) {
+      threads_.emplace_back([this]() { Work(); });
+    }
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    work_.notify_all();
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  size_t num_threads() const { return threads_.size(); }
+
+  // Call task(i) for every i < num and return once all calls have returned.
+  void Run(size_t num, const std::function<void(size_t)>& task) {
+    if (threads_.empty() || num <= 1) {
+      for (size_t i = 0; i < num; ++i) {
+        task(i);
+      }
+      return;
+    }
+    std::lock_guard<std::mutex> group(group_mutex_);
+    std::unique_lock<std::mutex> lock(mutex_);
+    task_ = &task;
+    num_tasks_ = num;
+    next_ = 0;
+    done_ = 0;
+    work_.notify_all();
+    while (next_ < num_tasks_) {
+      RunNext(lock);
+    }
+    finished_.wait(lock, [this]() { return done_ == num_tasks_; });
+    num_tasks_ = next_ = 0;
+    task_ = nullptr;
+  }
+
+  private:
+  void Work() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      work_.wait(lock, [this]() { return stop_ || next_ < num_tasks_; });
+      if (stop_) {
+        return;
+      }
+      RunNext(lock);
+    }
+  }
+
+  // Run the next call of the group, without holding the lock.
+  void RunNext(std::unique_lock<std::mutex>& lock) {
+    const size_t i = next_++;
+    const auto& task = *task_;
+    lock.unlock();
+    task(i);
+    lock.lock();
+    if (++done_ == num_tasks_) {
+      finished_.notify_all();
+    }
+  }
+
+  std::vector<std::thread> threads_;
+  std::mutex group_mutex_;
+  std::mutex mutex_;
+  std::condition_variable work_;
+  std::condition_variable finished_;
+  size_t num_tasks_;
+  size_t next_;
+  size_t done_;
+  const std::function<void(size_t)>* task_;
+  bool stop_;
+};
+
+// Front end that splits the point set into spatial shards, each indexed by its own RangeSearch, and
+// answers a query from the shards whose bounding boxes it overlaps only. assign cuts the points at
+// the median along the longer side of their bounding box, recursively, into num_shards cells of
+// nearly equal size and builds the shards in parallel. Queries touching several shards fan out to
+// them in parallel and merge their results; each point is in exactly one shard. While the profiler
+// or the traversal counters are on, shards are built and queried one at a time.
+//
+// The shards come from a factory, e.g. RPlusTrees in this process or RemoteShards in other
+// processes. Queries may come from several threads only if the shards allow that.
+template<class Point>
+class ShardedRangeSearch : public RangeSearch<Point> {
+
+  public:
+  using Factory = std::function<RangeSearch<Point>*()>;
+
+  // num_threads threads (plus the calling thread) build the shards and run fanned-out queries; by
+  // default one per shard, up to the number of CPUs.
+  ShardedRangeSearch(size_t num_shards, const Factory& factory, size_t num_threads = 0) : queries_(0), shards_queried_(0) {
+    for (size_t i = 0; i < std::max<size_t>(num_shards, 1); ++i) {
+      shards_.emplace_back(factory());
+    }
+    boxes_.resize(shards_.size());
+    sizes_.resize(shards_.size(), 0);
+    if (num_threads == 0) {
+      num_threads = std::min<size_t>(shards_.size(), std::max(1u, std::thread::hardware_concurrency()));
+    }
+    // Started after the shards, which may fork.
+    pool_.reset(new WorkerPool(num_threads - 1));
+  }
+
+  void assign(const std::vector<Point>& points) override {
+    assign(points.data(), points.data() + points.size());
+  }
+
+  void assign(const Point* begin, const Point* end) override {
+    std::vector<Point> points(begin, end);
+    std::vector<std::pair<Point*, Point*>> cells;
+    Split(points.data(), points.data() + points.size(), shards_.size(), cells);
+    cells.resize(shards_.size(), std::make_pair(points.data(), points.data()));
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      sizes_[i] = cells[i].second - cells[i].first;
+      if (sizes_[i] > 0) {
+        boxes_[i] = Rectangle<Point>(*cells[i].first, *cells[i].first);
+        for (const Point* p = cells[i].first; p != cells[i].second; ++p) {
+          boxes_[i].Extend(Rectangle<Point>(*p, *p));
+        }
+      }
+    }
+    Run(shards_.size(), [&](size_t i) { shards_[i]->assign(cells[i].first, cells[i].second); });
+    queries_ = shards_queried_ = 0;
+  }
+
+  void reportRange(const Point& min, const Point& max, std::vector<Point>& result) override {
+    FanOut(Rectangle<Point>(min, max), result, [&](RangeSearch<Point>& shard, std::vector<Point>& part) { shard.reportRange(min, max, part); });
+  }
+
+  size_t countRange(const Point& min, const Point& max) override {
+    const auto shards = Overlapping(Rectangle<Point>(min, max));
+    std::vector<size_t> counts(shards.size());
+    Run(shards.size(), [&](size_t i) { counts[i] = shards_[shards[i]]->countRange(min, max); });
+    size_t count = 0;
+    for (size_t c : counts) {
+      count += c;
+    }
+    return count;
+  }
+
+  void reportCircle(const Point& center, double radius, std::vector<Point>& result) override {
+    FanOut(Circle<Point>(center, radius).BoundingBox(), result, [&](RangeSearch<Point>& shard, std::vector<Point>& part) { shard.reportCircle(center, radius, part); });
+  }
+
+  void reportPolygon(const std::vector<Point>& vertices, std::vector<Point>& result) override {
+    FanOut(ConvexPolygon<Point>(vertices).BoundingBox(), result, [&](RangeSearch<Point>& shard, std::vector<Point>& part) { shard.reportPolygon(vertices, part); });
+  }
+
+  // Asks the shards in order of the distance of their bounding boxes, one after the other, and stops
+  // at the first shard farther away than the k-th nearest point found so far.
+  void reportNearest(const Point& center, size_t k, std::vector<Point>& result) override {
+    auto distance = [&center](const Point& p) {
+      return (p[0] - center[0]) * (p[0] - center[0]) + (p[1] - center[1]) * (p[1] - center[1]);
+    };
+    auto nearer = [&distance](const Point& a, const Point& b) { return distance(a) < distance(b); };
+    std::vector<std::pair<double, size_t>> shards;
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      if (sizes_[i] > 0) {
+        shards.emplace_back(boxes_[i].SquaredDistance(center), i);
+      }
+    }
+    std::sort(shards.begin(), shards.end());
+    std::vector<Point> nearest, part, merged;
+    for (const auto& shard : shards) {
+      if (k == 0 || (nearest.size() == k && shard.first > distance(nearest.back()))) {
+        break;
+      }
+      part.clear();
+      shards_[shard.second]->reportNearest(center, k, part);
+      merged.clear();
+      std::merge(nearest.begin(), nearest.end(), part.begin(), part.end(), std::back_inserter(merged), nearer);
+      merged.resize(std::min(merged.size(), k));
+      nearest.swap(merged);
+    }
+    result.insert(result.end(), nearest.begin(), nearest.end());
+  }
+
+  // Shard sizes, the average number of shards per query since the last assign and the first
+  // shard's own metrics.
+  Metrics metrics() const override {
+    Metrics m;
+    m.emplace_back("shards", static_cast<double>(shards_.size()));
+    m.emplace_back("threads", static_cast<double>(pool_->num_threads() + 1));
+    m.emplace_back("shardmin", static_cast<double>(*std::min_element(sizes_.begin(), sizes_.end())));
+    m.emplace_back("shardmax", static_cast<double>(*std::max_element(sizes_.begin(), sizes_.end())));
+    const size_t queries = queries_;
+    m.emplace_back("fanout", queries ? static_cast<double>(shards_queried_) / queries : 0);
+    for (const auto& metric : shards_[0]->metrics()) {
+      m.emplace_back("shard0" + metric.first, metric.second);
+    }
+    return m;
+  }
+
+  private:
+  // Split [begin, end) into num_cells cells, appended to cells. Fewer points than cells leave some
+  // cells out.
+  static void Split(Point* begin, Point* end, size_t num_cells, std::vector<std::pair<Point*, Point*>>& cells) {
+    if (num_cells == 1 || end - begin <= 1) {
+      cells.emplace_back(begin, end);
+      return;
+    }
+    Rectangle<Point> box(*begin, *begin);
+    for (const Point* p = begin; p != end; ++p) {
+      box.Extend(Rectangle<Point>(*p, *p));
+    }
+    const int axis = box.max_side(Axis::X) - box.min_side(Axis::X) >= box.max_side(Axis::Y) - box.min_side(Axis::Y) ? 0 : 1;
+    const size_t num_lower = num_cells / 2;
+    Point* middle = begin + (end - begin) * num_lower / num_cells;
+    std::nth_element(begin, middle, end, [axis](const Point& a, const Point& b) { return a[axis] < b[axis]; });
+    Split(begin, middle, num_lower, cells);
+    Split(middle, end, num_cells - num_lower, cells);
+  }
+
+  // Call task(i) for every i < num on the pool, or one after the other while the profiler or the
+  // traversal counters are on: both are global and not thread-safe.
+  void Run(size_t num, const std::function<void(size_t)>& task) {
+    if (Profiler::get().enabled() || TraversalStats::kEnabled) {
+      for (size_t i = 0; i < num; ++i) {
+        task(i);
+      }
+    } else {
+      pool_->Run(num, task);
+    }
+  }
+
+  // Indices of the non-empty shards whose bounding boxes overlap window.
+  std::vector<size_t> Overlapping(const Rectangle<Point>& window) {
+    std::vector<size_t> shards;
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      if (sizes_[i] > 0 && boxes_[i].Overlaps(window)) {
+        shards.push_back(i);
+      }
+    }
+    ++queries_;
+    shards_queried_ += shards.size();
+    return shards;
+  }
+
+  // Run query on the shards overlapping window and append their results to result. The first shard
+  // reports into result directly.
+  template<class Query>
+  void FanOut(const Rectangle<Point>& window, std::vector<Point>& result, const Query& query) {
+    const auto shards = Overlapping(window);
+    std::vector<std::vector<Point>> parts(shards.size() > 1 ? shards.size() - 1 : 0);
+    Run(shards.size(), [&](size_t i) { query(*shards_[shards[i]], i == 0 ? result : parts[i - 1]); });
+    for (const auto& part : parts) {
+      result.insert(result.end(), part.begin(), part.end());
+    }
+  }
+
+  std::vector<std::unique_ptr<RangeSearch<Point>>> shards_;
+  std::vector<Rectangle<Point>> boxes_;
+  std::vector<size_t> sizes_;
+  std::unique_ptr<WorkerPool> pool_;
+  std::atomic<size_t> queries_;
+  std::atomic<size_t> shards_queried_;
+};
+
+}  // namespace range_search
+#endif  // RANGE_SEARCH_SHARDED_H_
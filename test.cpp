@@ -1,14 +1,699 @@
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cmath>
+#include <functional>
 #include <iostream>
+#include <limits>
 #include <random>
+#include <stdexcept>
+#include <thread>
 #include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 using namespace std;
 
+#include "naive.h"
+#include "remote_shard.h"
 #include "rplus.h"
+#include "rplus_autotune.h"
+#include "rplus_concurrent.h"
+#include "rplus_numa.h"
+#include "sharded.h"
 
 using Point = array<double, 2>;
+using Window = pair<Point, Point>;
 
+/// Prints what failed unless ok.
+bool check(bool ok, const string& what) {
+    if (!ok)
+        cout << "FAILED: " << what << endl;
+    return ok;
+}
+
+vector<Point> sorted(vector<Point> points) {
+    sort(points.begin(), points.end());
+    return points;
+}
+
+/// Points spread uniformly over [0, extent)^2, all distinct in practice.
+vector<Point> distinctPoints(default_random_engine& re, size_t num, double extent) {
+    uniform_real_distribution<double> coord(0, extent);
+    vector<Point> points;
+    for (size_t i = 0; i < num; i++)
+        points.push_back({{coord(re), coord(re)}});
+    return points;
+}
+
+vector<Window> randomWindows(default_random_engine& re, size_t num, int grid) {
+    uniform_real_distribution<double> coord(-1, grid);
+    vector<Window> windows;
+    for (size_t i = 0; i < num; i++) {
+        Point a = {{coord(re), coord(re)}}, b = {{coord(re), coord(re)}};
+        windows.emplace_back(Point{{min(a[0], b[0]), min(a[1], b[1])}}, Point{{max(a[0], b[0]), max(a[1], b[1])}});
+    }
+    return windows;
+}
+
+/// Compares reportRange of index and naive on windows.
+template<class Index>
+bool sameReports(Index& index, range_search::Naive<Point>& naive, const vector<Window>& windows, const string& what) {
+    bool ok = true;
+    for (const Window& w : windows) {
+        vector<Point> expected, actual;
+        naive.reportRange(w.first, w.second, expected);
+        index.reportRange(w.first, w.second, actual);
+        ok &= check(sorted(actual) == sorted(expected), what + ": reportRange");
+    }
+    return ok;
+}
+
+/// Compares reportRange and countRange of tree and naive on windows.
+bool sameRanges(range_search::RangeSearch<Point>& tree, range_search::Naive<Point>& naive, const vector<Window>& windows, const string& what) {
+    bool ok = sameReports(tree, naive, windows, what);
+    for (const Window& w : windows)
+        ok &= check(tree.countRange(w.first, w.second) == naive.countRange(w.first, w.second), what + ": countRange");
+    return ok;
+}
+
+/// AutoTunedRPlusTree answers like Naive whichever capacity it picks, also for fewer points than
+/// it samples and for a single point, which it does not tune for.
+bool testAutoTuned(default_random_engine& re) {
+    bool ok = true;
+    for (size_t num_points : {1, 100, 3000}) {
+        range_search::AutoTunedRPlusTree<Point> tree(512, 16);
+        range_search::Naive<Point> naive;
+        const vector<Point> points = distinctPoints(re, num_points, 1000);
+        tree.assign(points);
+        naive.assign(points);
+        ok &= check(tree.capacity() != 0, "AutoTunedRPlusTree: capacity");
+        ok &= sameRanges(tree, naive, randomWindows(re, 20, 1000), "AutoTunedRPlusTree with " + to_string(num_points) + " points");
+    }
+    // Doubling an input far larger than the sample hardly changes the estimates, so the capacity
+    // chosen for either size must be about as good for the other one. Timing noise allows some
+    // leeway.
+    const vector<Point> points = distinctPoints(re, 1 << 20, 1000);
+    range_search::AutoTunedRPlusTree<Point> half(1024, 64), full(1024, 64);
+    const size_t half_capacity = half.chooseCapacity(points.data(), points.data() + points.size() / 2);
+    const size_t full_capacity = full.chooseCapacity(points.data(), points.data() + points.size());
+    auto relativeCost = [](const range_search::AutoTunedRPlusTree<Point>& tree, size_t capacity) {
+        double best = numeric_limits<double>::max(), cost = 0;
+        for (const auto& c : tree.candidates()) {
+            best = min(best, c.query_seconds);
+            if (c.capacity == capacity)
+                cost = c.query_seconds;
+        }
+        return cost / best;
+    };
+    ok &= check(relativeCost(half, full_capacity) < 2 && relativeCost(full, half_capacity) < 2,
+                "AutoTunedRPlusTree: capacity " + to_string(half_capacity) + " for " + to_string(points.size() / 2)
+                + " points, " + to_string(full_capacity) + " for " + to_string(points.size()));
+    return ok;
+}
+
+/// Trees whose leaves hold more or fewer entries than their inner nodes.
+bool testCapacities(default_random_engine& re) {
+    const vector<Point> points = distinctPoints(re, 3000, 1000);
+    const vector<Window> windows = randomWindows(re, 20, 1000);
+    range_search::Naive<Point> naive;
+    naive.assign(points);
+    range_search::RPlusTree<Point, 4, 16> wide;
+    range_search::RPlusTree<Point, 32, 4> narrow;
+    wide.assign(points);
+    narrow.assign(points);
+    bool ok = sameRanges(wide, naive, windows, "RPlusTree<Point, 4, 16>");
+    ok &= sameRanges(narrow, naive, windows, "RPlusTree<Point, 32, 4>");
+    return ok;
+}
+
+/// Nodes sized to their entries, on uniform points and on a dense cluster among them, whose splits
+/// leave many partly filled nodes.
+bool testNodeSizes(default_random_engine& re) {
+    vector<Point> points = distinctPoints(re, 2000, 1000);
+    for (Point p : distinctPoints(re, 1000, 10)) {
+        p[0] += 500;
+        p[1] += 500;
+        points.push_back(p);
+    }
+    range_search::Naive<Point> naive;
+    naive.assign(points);
+    range_search::RPlusTree<Point, 8, 64> tree;
+    tree.assign(points);
+    bool ok = sameRanges(tree, naive, randomWindows(re, 20, 1000), "RPlusTree<Point, 8, 64>");
+    // Windows around the cluster.
+    ok &= sameRanges(tree, naive, {{Point{{500, 500}}, Point{{510, 510}}}, {Point{{505, 495}}, Point{{505.5, 520}}}}, "RPlusTree<Point, 8, 64> cluster");
+    return ok;
+}
+
+/// Several rounds of applyDelta, deleting present and missing points.
+bool testApplyDelta(default_random_engine& re) {
+    const int extent = 1000;
+    range_search::RPlusTree<Point, 8> tree;
+    range_search::Naive<Point> naive;
+    vector<Point> points = distinctPoints(re, 2000, extent);
+    tree.assign(points);
+    naive.assign(points);
+    bool ok = true;
+    for (int round = 0; round < 10; round++) {
+        vector<Point> inserts = distinctPoints(re, 100, extent);
+        vector<Point> deletes = distinctPoints(re, 50, extent);  // missing
+        for (int i = 0; i < 100; i++)
+            deletes.push_back(points[re() % points.size()]);
+        tree.applyDelta(inserts, deletes);
+        naive.applyDelta(inserts, deletes);
+        points.insert(points.end(), inserts.begin(), inserts.end());
+        ok &= sameRanges(tree, naive, randomWindows(re, 20, extent), "applyDelta");
+    }
+    return ok;
+}
+
+/// Snapshots keep answering from their version while applyDelta publishes new ones.
+bool testSnapshots(default_random_engine& re) {
+    const int extent = 1000;
+    range_search::ConcurrentRPlusTree<Point, 8> tree;
+    range_search::Naive<Point> before;
+    vector<Point> points = distinctPoints(re, 2000, extent);
+    tree.assign(points);
+    before.assign(points);
+    const vector<Window> windows = randomWindows(re, 20, extent);
+    bool ok = true;
+    auto old_version = tree.snapshot();
+    for (int round = 0; round < 5; round++) {
+        range_search::Naive<Point> after = before;
+        vector<Point> inserts = distinctPoints(re, 100, extent);
+        vector<Point> deletes;
+        for (int i = 0; i < 100; i++)
+            deletes.push_back(points[re() % points.size()]);
+        auto previous = tree.snapshot();
+        tree.applyDelta(inserts, deletes);
+        after.applyDelta(inserts, deletes);
+        points.insert(points.end(), inserts.begin(), inserts.end());
+        auto current = tree.snapshot();
+        ok &= sameReports(previous, before, windows, "snapshot before applyDelta");
+        ok &= sameReports(current, after, windows, "snapshot after applyDelta");
+        ok &= sameRanges(tree, after, windows, "ConcurrentRPlusTree after applyDelta");
+        before = after;
+    }
+    range_search::Naive<Point> first;
+    first.assign(vector<Point>(points.begin(), points.begin() + 2000));
+    ok &= sameReports(old_version, first, windows, "snapshot before all deltas");
+    return ok;
+}
+
+/// Readers take snapshots while a writer applies deltas. Every snapshot must show one of the
+/// versions published around the time it was taken.
+bool testConcurrentReaders(default_random_engine& re) {
+    const int extent = 1000;
+    const Window window(Point{{250, 250}}, Point{{750, 750}});
+    range_search::ConcurrentRPlusTree<Point, 8> tree;
+    range_search::Naive<Point> naive;
+    vector<Point> points = distinctPoints(re, 2000, extent);
+    tree.assign(points);
+    naive.assign(points);
+    auto contents = [&]() {
+        vector<Point> result;
+        naive.reportRange(window.first, window.second, result);
+        return sorted(result);
+    };
+    // The deltas, and the sorted contents of window in every version, computed up front.
+    vector<pair<vector<Point>, vector<Point>>> deltas;
+    vector<vector<Point>> versions(1, contents());
+    for (int i = 0; i < 50; i++) {
+        vector<Point> inserts = distinctPoints(re, 20, extent);
+        vector<Point> deletes;
+        for (int j = 0; j < 20; j++)
+            deletes.push_back(points[re() % points.size()]);
+        naive.applyDelta(inserts, deletes);
+        points.insert(points.end(), inserts.begin(), inserts.end());
+        versions.push_back(contents());
+        deltas.emplace_back(inserts, deletes);
+    }
+    atomic<size_t> published(0), mismatches(0), reads(0);
+    atomic<bool> done(false);
+    vector<thread> readers;
+    for (int i = 0; i < 2; i++) {
+        readers.emplace_back([&]() {
+            vector<Point> result;
+            do {
+                // The snapshot's version is at least first, and at most one ahead of last, as the
+                // writer publishes a version before it counts it.
+                const size_t first = published;
+                const auto snapshot = tree.snapshot();
+                const size_t last = min(published + 1, versions.size() - 1);
+                result.clear();
+                snapshot.reportRange(window.first, window.second, result);
+                sort(result.begin(), result.end());
+                bool found = false;
+                for (size_t v = first; v <= last; v++)
+                    found |= result == versions[v];
+                mismatches += !found;
+                ++reads;
+            } while (!done);
+        });
+    }
+    for (const auto& delta : deltas) {
+        tree.applyDelta(delta.first, delta.second);
+        ++published;
+        this_thread::yield();
+    }
+    done = true;
+    for (auto& reader : readers)
+        reader.join();
+    bool ok = check(mismatches == 0, "snapshot taken during applyDelta: " + to_string(mismatches) + " of " + to_string(reads));
+    ok &= sameRanges(tree, naive, randomWindows(re, 20, extent), "ConcurrentRPlusTree after concurrent reads");
+    return ok;
+}
+
+/// Points with integer coordinates in [0, grid), so that some occur several times.
+vector<Point> randomPoints(default_random_engine& re, size_t num, int grid) {
+    uniform_int_distribution<int> coord(0, grid - 1);
+    vector<Point> points;
+    for (size_t i = 0; i < num; i++)
+        points.push_back({{double(coord(re)), double(coord(re))}});
+    return points;
+}
+
+/// Points occurring many times, deleted several times over, more often than they occur as well.
+bool testDuplicates(default_random_engine& re) {
+    const int grid = 20;
+    range_search::RPlusTree<Point, 8> tree;
+    range_search::Naive<Point> naive;
+    const vector<Point> points = randomPoints(re, 2000, grid);
+    tree.assign(points);
+    naive.assign(points);
+    bool ok = sameRanges(tree, naive, randomWindows(re, 20, grid), "duplicates");
+    for (int round = 0; round < 10; round++) {
+        vector<Point> inserts = randomPoints(re, 50, grid);
+        vector<Point> deletes;
+        for (const Point& p : randomPoints(re, 20, grid))
+            deletes.insert(deletes.end(), 1 + re() % 10, p);
+        tree.applyDelta(inserts, deletes);
+        naive.applyDelta(inserts, deletes);
+        ok &= sameRanges(tree, naive, randomWindows(re, 20, grid), "duplicate deletes");
+    }
+    return ok;
+}
+
+struct Tagged {
+    int attribute;
+};
+
+/// reportRange with an attribute filter finds what Naive finds among the points with attributes in
+/// range.
+bool testAttributes(default_random_engine& re) {
+    const int grid = 1000;
+    using Tree = range_search::RPlusTree<Point, 8, 8, Tagged>;
+    Tree tree;
+    vector<Tree::Record> records;
+    for (const Point& p : randomPoints(re, 2000, grid))
+        records.emplace_back(p, Tagged{int(re() % 100)});
+    tree.assign(records);
+    const vector<Window> windows = randomWindows(re, 20, grid);
+    bool ok = true;
+    for (int round = 0; round < 10; round++) {
+        const int lo = re() % 100, hi = lo + re() % 30;
+        vector<Point> in_range;
+        for (const auto& r : records)
+            if (lo <= r.second.attribute && r.second.attribute <= hi)
+                in_range.push_back(r.first);
+        range_search::Naive<Point> naive;
+        naive.assign(in_range);
+        for (const Window& w : windows) {
+            vector<Point> expected, actual;
+            vector<Tree::Record> result;
+            naive.reportRange(w.first, w.second, expected);
+            tree.reportRange(w.first, w.second, lo, hi, result);
+            for (const auto& r : result) {
+                ok &= check(lo <= r.second.attribute && r.second.attribute <= hi, "attribute filter: attribute out of range");
+                actual.push_back(r.first);
+            }
+            ok &= check(sorted(actual) == sorted(expected), "attribute filter: reportRange");
+        }
+    }
+    return ok;
+}
+
+/// aggregateRange matches Naive's after assignWeighted and after applyDelta, which inserts points
+/// of weight 0. Integer weights keep the sums exact. The points are distinct: which of several equal
+/// points a delete removes is up to the index, and with it which weight goes.
+bool testAggregates(default_random_engine& re) {
+    const int grid = 1000;
+    range_search::RPlusTree<Point, 8, 8, range_search::Weight> tree;
+    range_search::Naive<Point> naive;
+    const vector<Point> points = distinctPoints(re, 2000, grid);
+    vector<double> weights;
+    for (size_t i = 0; i < points.size(); i++)
+        weights.push_back(double(re() % 1000) - 500);
+    tree.assignWeighted(points.data(), points.data() + points.size(), weights.data());
+    naive.assignWeighted(points.data(), points.data() + points.size(), weights.data());
+    bool ok = true;
+    for (int round = 0; round < 5; round++) {
+        for (const Window& w : randomWindows(re, 20, grid)) {
+            const range_search::Aggregate expected = naive.aggregateRange(w.first, w.second);
+            const range_search::Aggregate actual = tree.aggregateRange(w.first, w.second);
+            ok &= check(actual.count == expected.count && actual.sum == expected.sum
+                    && actual.min == expected.min && actual.max == expected.max, "aggregateRange");
+            ok &= check(tree.countRange(w.first, w.second) == expected.count, "weighted countRange");
+        }
+        vector<Point> deletes;
+        for (int i = 0; i < 100; i++)
+            deletes.push_back(points[re() % points.size()]);
+        const vector<Point> inserts = distinctPoints(re, 100, grid);
+        tree.applyDelta(inserts, deletes);
+        naive.applyDelta(inserts, deletes);
+    }
+    return ok;
+}
+
+/// reportCircle and reportPolygon match Naive's, with the polygon's vertices in counterclockwise
+/// and in clockwise order.
+bool testShapes(default_random_engine& re) {
+    const int grid = 1000;
+    range_search::RPlusTree<Point, 8> tree;
+    range_search::Naive<Point> naive;
+    const vector<Point> points = randomPoints(re, 2000, grid);
+    tree.assign(points);
+    naive.assign(points);
+    uniform_real_distribution<double> coord(0, grid), radius(0, grid / 4), angle(0, 2 * M_PI);
+    bool ok = true;
+    for (int round = 0; round < 20; round++) {
+        const Point center = {{coord(re), coord(re)}};
+        const double r = radius(re);
+        vector<Point> expected, actual;
+        naive.reportCircle(center, r, expected);
+        tree.reportCircle(center, r, actual);
+        ok &= check(sorted(actual) == sorted(expected), "reportCircle");
+
+        // Vertices on an ellipse, in counterclockwise order of their angles.
+        vector<double> angles;
+        for (int i = 0; i < 3 + round % 6; i++)
+            angles.push_back(angle(re));
+        sort(angles.begin(), angles.end());
+        const double rx = radius(re), ry = radius(re);
+        vector<Point> vertices;
+        for (double a : angles)
+            vertices.push_back({{center[0] + rx * cos(a), center[1] + ry * sin(a)}});
+        for (int order = 0; order < 2; order++) {
+            expected.clear();
+            actual.clear();
+            naive.reportPolygon(vertices, expected);
+            tree.reportPolygon(vertices, actual);
+            ok &= check(sorted(actual) == sorted(expected), order ? "reportPolygon, clockwise" : "reportPolygon, counterclockwise");
+            reverse(vertices.begin(), vertices.end());
+        }
+    }
+    // Fewer than three vertices are no polygon.
+    bool thrown = false;
+    try {
+        vector<Point> result;
+        tree.reportPolygon({Point{{0, 0}}, Point{{grid, grid}}}, result);
+    } catch (const invalid_argument&) {
+        thrown = true;
+    }
+    ok &= check(thrown, "reportPolygon with two vertices");
+    return ok;
+}
+
+struct Object {
+    Rectangle<Point> extent;
+    size_t id;
+};
+
+/// Ids of the objects reported by query, sorted. Duplicates stay, so that they fail the comparison.
+template<class Query>
+vector<size_t> reportedIds(const Query& query) {
+    vector<Object> result;
+    query(result);
+    vector<size_t> ids;
+    for (const Object& o : result)
+        ids.push_back(o.id);
+    sort(ids.begin(), ids.end());
+    return ids;
+}
+
+/// reportIntersecting and reportStabbing report every rectangle that overlaps the window or
+/// contains the point exactly once, though many are clipped into several leaves. Naive has no
+/// rectangles, so the expected ids come from testing every rectangle. Integer coordinates put many
+/// windows and points on the rectangles' edges.
+bool testRectangles(default_random_engine& re) {
+    const int grid = 1000;
+    range_search::RPlusTree<Point, 8, 8, Object> tree;
+    vector<Object> objects;
+    for (size_t i = 0; i < 1000; i++) {
+        const Point corner = randomPoints(re, 1, grid)[0];
+        const double size = i % 10 ? re() % 50 : re() % 500;  // some span many leaves
+        objects.push_back({Rectangle<Point>(corner, {{corner[0] + size, corner[1] + re() % 50}}), i});
+    }
+    tree.assignObjects(objects);
+    bool ok = true;
+    for (const Window& w : randomWindows(re, 50, grid)) {
+        const Rectangle<Point> window({{floor(w.first[0]), floor(w.first[1])}}, {{ceil(w.second[0]), ceil(w.second[1])}});
+        vector<size_t> expected;
+        for (const Object& o : objects)
+            if (window.Overlaps(o.extent))
+                expected.push_back(o.id);
+        ok &= check(reportedIds([&](vector<Object>& result) {
+            tree.reportIntersecting(window.bottom_left(), window.top_right(), result);
+        }) == expected, "reportIntersecting");
+    }
+    for (const Point& p : randomPoints(re, 50, grid)) {
+        vector<size_t> expected;
+        for (const Object& o : objects)
+            if (o.extent.Contains(p))
+                expected.push_back(o.id);
+        ok &= check(reportedIds([&](vector<Object>& result) { tree.reportStabbing(p, result); }) == expected, "reportStabbing");
+    }
+    // Point queries would see the clipped pieces.
+    auto rejects = [](const function<void()>& query) {
+        try {
+            query();
+        } catch (const logic_error&) {
+            return true;
+        }
+        return false;
+    };
+    const Point lo = {{0, 0}}, hi = {{grid, grid}};
+    const Window window(lo, hi);
+    vector<Point> points;
+    size_t count;
+    ok &= check(rejects([&] { tree.reportRange(lo, hi, points); }), "reportRange on rectangles");
+    ok &= check(rejects([&] { tree.countRange(lo, hi); }), "countRange on rectangles");
+    ok &= check(rejects([&] { tree.reportRanges(&window, 1, &points); }), "reportRanges on rectangles");
+    ok &= check(rejects([&] { tree.countRanges(&window, 1, &count); }), "countRanges on rectangles");
+    ok &= check(rejects([&] { tree.reportNearest(lo, 1, points); }), "reportNearest on rectangles");
+    ok &= check(rejects([&] { tree.reportCircle(lo, grid, points); }), "reportCircle on rectangles");
+    ok &= check(rejects([&] { tree.applyDelta({lo}, {}); }), "applyDelta on rectangles");
+    return ok;
+}
+
+/// Compares countRanges and reportRanges of tree with Naive's reportRange, query by query.
+template<class Tree>
+bool sameBatches(Tree& tree, range_search::Naive<Point>& naive, const vector<Window>& windows, const string& what) {
+    vector<size_t> counts(windows.size());
+    vector<vector<Point>> results(windows.size());
+    tree.countRanges(windows.data(), windows.size(), counts.data());
+    tree.reportRanges(windows.data(), windows.size(), results.data());
+    bool ok = true;
+    for (size_t i = 0; i < windows.size(); i++) {
+        vector<Point> expected;
+        naive.reportRange(windows[i].first, windows[i].second, expected);
+        ok &= check(counts[i] == expected.size(), what + ": countRanges");
+        ok &= check(sorted(results[i]) == sorted(expected), what + ": reportRanges");
+    }
+    return ok;
+}
+
+/// Batches of fewer and of more queries than are interleaved at a time.
+bool testBatches(default_random_engine& re) {
+    const int grid = 100;
+    range_search::RPlusTree<Point, 8> tree;
+    range_search::ConcurrentRPlusTree<Point, 8> concurrent;
+    range_search::Naive<Point> naive;
+    const vector<Point> points = randomPoints(re, 2000, grid);
+    tree.assign(points);
+    concurrent.assign(points);
+    naive.assign(points);
+    bool ok = true;
+    for (size_t num : {0, 1, 7, 100}) {
+        const vector<Window> windows = randomWindows(re, num, grid);
+        ok &= sameBatches(tree, naive, windows, "RPlusTree");
+        ok &= sameBatches(concurrent, naive, windows, "ConcurrentRPlusTree");
+    }
+    return ok;
+}
+
+/// Trees in an arena on huge pages, copies of them and replicas on every NUMA node.
+bool testPlacement(default_random_engine& re) {
+    const int grid = 1000;
+    const vector<Point> points = randomPoints(re, 2000, grid);
+    const vector<Window> windows = randomWindows(re, 20, grid);
+    range_search::Naive<Point> naive;
+    naive.assign(points);
+    range_search::NodePlacement placement;
+    placement.huge_pages = true;
+    range_search::RPlusTree<Point, 8> tree(placement), copy(placement);
+    tree.assign(points);
+    copy.assignCopy(tree);
+    bool ok = sameRanges(tree, naive, windows, "RPlusTree on huge pages");
+    ok &= sameRanges(copy, naive, windows, "RPlusTree copied by assignCopy");
+    range_search::ReplicatedRPlusTree<Point, 8> replicated(true);
+    replicated.assign(points);
+    ok &= sameRanges(replicated, naive, windows, "ReplicatedRPlusTree");
+    // Nodes replaced by applyDelta live outside the arena; the copy keeps the old points.
+    range_search::Naive<Point> changed = naive;
+    const vector<Point> inserts = randomPoints(re, 100, grid);
+    const vector<Point> deletes(points.begin(), points.begin() + 100);
+    tree.applyDelta(inserts, deletes);
+    changed.applyDelta(inserts, deletes);
+    ok &= sameRanges(tree, changed, windows, "RPlusTree on huge pages after applyDelta");
+    ok &= sameRanges(copy, naive, windows, "RPlusTree copied by assignCopy after applyDelta to the original");
+    return ok;
+}
+
+/// Compares reportCircle and reportPolygon of index with Naive's.
+bool sameShapes(range_search::RangeSearch<Point>& index, range_search::Naive<Point>& naive, default_random_engine& re, int grid, const string& what) {
+    uniform_real_distribution<double> coord(0, grid), radius(0, grid / 4);
+    bool ok = true;
+    for (int i = 0; i < 5; i++) {
+        const Point center = {{coord(re), coord(re)}};
+        const double r = radius(re);
+        vector<Point> expected, actual;
+        naive.reportCircle(center, r, expected);
+        index.reportCircle(center, r, actual);
+        ok &= check(sorted(actual) == sorted(expected), what + ": reportCircle");
+        const vector<Point> triangle = {center, {{center[0] + r, center[1]}}, {{center[0], center[1] + r}}};
+        expected.clear();
+        actual.clear();
+        naive.reportPolygon(triangle, expected);
+        index.reportPolygon(triangle, actual);
+        ok &= check(sorted(actual) == sorted(expected), what + ": reportPolygon");
+    }
+    return ok;
+}
+
+/// Sharded range queries match Naive's, with shards in this process and in forked ones, and with
+/// fewer points than shards.
+bool testSharded(default_random_engine& re) {
+    const int grid = 1000;
+    using Tree = range_search::RPlusTree<Point, 8>;
+    bool ok = true;
+    for (size_t num_points : {3, 2000}) {
+        const vector<Point> points = randomPoints(re, num_points, grid);
+        range_search::Naive<Point> naive;
+        naive.assign(points);
+        const vector<Window> windows = randomWindows(re, 20, grid);
+        // Forked first, before the other indexes start threads.
+        range_search::ShardedRangeSearch<Point> remote(3, []() { return new range_search::RemoteShard<Point, Tree>; }, 1);
+        remote.assign(points);
+        ok &= sameRanges(remote, naive, windows, "ShardedRangeSearch of RemoteShards");
+        ok &= sameShapes(remote, naive, re, grid, "ShardedRangeSearch of RemoteShards");
+        // The shard reports an invalid polygon as an error, and keeps serving.
+        range_search::RemoteShard<Point, Tree> shard;
+        shard.assign(points);
+        vector<Point> result;
+        try {
+            shard.reportPolygon({{{0, 0}}, {{1, 1}}}, result);
+            ok &= check(false, "RemoteShard: reportPolygon with two vertices");
+        } catch (const invalid_argument&) {
+        }
+        ok &= sameRanges(shard, naive, windows, "RemoteShard after an error");
+        for (size_t num_shards : {1, 4, 5}) {
+            range_search::ShardedRangeSearch<Point> local(num_shards, []() { return new Tree; }, 3);
+            local.assign(points);
+            ok &= sameRanges(local, naive, windows, "ShardedRangeSearch with " + to_string(num_shards) + " shards");
+        }
+    }
+    return ok;
+}
+
+/// A shard answers malformed requests with an error and keeps serving.
+bool testShardErrors() {
+    using Tree = range_search::RPlusTree<Point, 8>;
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        return check(false, "socketpair");
+    thread shard([&fds]() {
+        try {
+            range_search::ServeShard<Point, Tree>(fds[1]);
+        } catch (...) {
+        }
+    });
+    auto request = [&fds](uint32_t op, const vector<Point>& points) {
+        const range_search::ShardRequest header = {op, 0, points.size(), 0, 0};
+        range_search::SendAll(fds[0], &header, sizeof(header));
+        range_search::SendAll(fds[0], points.data(), points.size() * sizeof(Point));
+        range_search::ShardResponse response = {0, 0, 0};
+        range_search::ReceiveAll(fds[0], &response, sizeof(response));
+        // Only assign and count requests succeed here, so nothing but an error message follows.
+        string message(response.flags & range_search::ShardResponse::kError ? response.count : 0, '\0');
+        if (!message.empty())
+            range_search::ReceiveAll(fds[0], &message[0], message.size());
+        return response;
+    };
+    const Point a = {{0, 0}}, b = {{10, 10}};
+    bool ok = check(request(range_search::ShardRequest::kAssign, {a, b}).flags == 0, "shard assign");
+    ok &= check(request(range_search::ShardRequest::kCount, {a}).flags == range_search::ShardResponse::kError, "shard count with one point");
+    ok &= check(request(range_search::ShardRequest::kReport, {}).flags == range_search::ShardResponse::kError, "shard report without points");
+    ok &= check(request(range_search::ShardRequest::kCircle, {a, b}).flags == range_search::ShardResponse::kError, "shard circle with two points");
+    ok &= check(request(range_search::ShardRequest::kPolygon, {a, b}).flags == range_search::ShardResponse::kError, "shard polygon with two vertices");
+    ok &= check(request(99, {a}).flags == range_search::ShardResponse::kError, "unknown shard request");
+    const range_search::ShardResponse count = request(range_search::ShardRequest::kCount, {a, b});
+    ok &= check(count.flags == 0 && count.count == 2, "shard count after errors");
+    close(fds[0]);
+    shard.join();
+    close(fds[1]);
+    return ok;
+}
+
+/// Squared distances of points to center, in the points' order.
+vector<double> distances(const Point& center, const vector<Point>& points) {
+    vector<double> result;
+    for (const Point& p : points)
+        result.push_back((p[0] - center[0]) * (p[0] - center[0]) + (p[1] - center[1]) * (p[1] - center[1]));
+    return result;
+}
+
+/// Compares reportNearest of index with Naive's. Ties may be broken differently, so only the
+/// distances, in increasing order, must agree.
+bool sameNearest(range_search::RangeSearch<Point>& index, range_search::Naive<Point>& naive, default_random_engine& re, int grid, const string& what) {
+    uniform_real_distribution<double> coord(-grid / 2, grid * 3 / 2);
+    bool ok = true;
+    for (size_t k : {0, 1, 10, 100, 3000}) {
+        for (int i = 0; i < 5; i++) {
+            const Point center = {{coord(re), coord(re)}};
+            vector<Point> expected, actual;
+            naive.reportNearest(center, k, expected);
+            index.reportNearest(center, k, actual);
+            ok &= check(distances(center, actual) == distances(center, expected), what + ": reportNearest");
+        }
+    }
+    return ok;
+}
+
+/// Nearest neighbours in trees, snapshots and shards, among duplicates and with k beyond the
+/// number of points.
+bool testNearest(default_random_engine& re) {
+    const int grid = 100;
+    const vector<Point> points = randomPoints(re, 2000, grid);
+    range_search::Naive<Point> naive;
+    naive.assign(points);
+    range_search::RPlusTree<Point, 8> tree;
+    tree.assign(points);
+    bool ok = sameNearest(tree, naive, re, grid, "RPlusTree");
+    range_search::ConcurrentRPlusTree<Point, 8> concurrent;
+    concurrent.assign(points);
+    ok &= sameNearest(concurrent, naive, re, grid, "ConcurrentRPlusTree");
+    for (size_t num_shards : {1, 5}) {
+        range_search::ShardedRangeSearch<Point> sharded(num_shards, []() { return new range_search::RPlusTree<Point, 8>; }, 3);
+        sharded.assign(points);
+        ok &= sameNearest(sharded, naive, re, grid, "ShardedRangeSearch with " + to_string(num_shards) + " shards");
+    }
+    range_search::ShardedRangeSearch<Point> remote(3, []() { return new range_search::RemoteShard<Point, range_search::RPlusTree<Point, 8>>; }, 1);
+    remote.assign(points);
+    ok &= sameNearest(remote, naive, re, grid, "ShardedRangeSearch of RemoteShards");
+    return ok;
+}
 
 int main(int argc, char** argv) {
     unsigned seed = 0;
@@ -37,5 +722,23 @@ int main(int argc, char** argv) {
    rplus.reportRange({-10000, -10000}, {10000, 10000}, res);
    cout << res.size() << endl;
 
-   return 0;
+   bool ok = true;
+   ok &= testAutoTuned(re);
+   ok &= testCapacities(re);
+   ok &= testNodeSizes(re);
+   ok &= testApplyDelta(re);
+   ok &= testSnapshots(re);
+   ok &= testConcurrentReaders(re);
+   ok &= testDuplicates(re);
+   ok &= testAttributes(re);
+   ok &= testAggregates(re);
+   ok &= testShapes(re);
+   ok &= testRectangles(re);
+   ok &= testBatches(re);
+   ok &= testPlacement(re);
+   ok &= testSharded(re);
+   ok &= testNearest(re);
+   ok &= testShardErrors();
+   cout << (ok ? "All tests passed" : "Some tests FAILED") << endl;
+   return ok ? 0 : 1;
 }
@@ -0,0 +1,177 @@
+// Measures ConcurrentRPlusTree with reader threads running range queries while
+// one writer keeps applying deltas: reports the readers' query latency and the
+// writer's update throughput.
+//
+// Every delta inserts and deletes the same number of points, so the tree always
+// holds the initial number of points; with -v readers check that every
+// snapshot does.
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../rplus_concurrent.h"
+
+using Point = std::array<double, 2>;
+using Tree = range_search::ConcurrentRPlusTree<Point, 64>;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+struct Options {
+    size_t points = 16384;
+    unsigned readers = 4;
+    double seconds = 2;
+    size_t delta = 64;
+    double selectivity = 0.001;
+    unsigned seed = 0;
+    bool verify = false;
+};
+
+void printUsage(const char* program_name) {
+    std::cerr << "Usage: " << program_name << " [options]"
+        "\n  -n <points>       number of points (default 16384)"
+        "\n  -r <readers>      number of reader threads (default 4)"
+        "\n  -t <seconds>      duration (default 2)"
+        "\n  -d <size>         points inserted and deleted per delta (default 64)"
+        "\n  -q <selectivity>  fraction of the points per query window (default 0.001)"
+        "\n  -s <seed>         random seed (default 0)"
+        "\n  -v                check that every snapshot holds all points"
+        << std::endl;
+}
+
+Point randomPoint(std::mt19937_64& rng) {
+    std::uniform_real_distribution<double> unif(0, 1);
+    return {{unif(rng), unif(rng)}};
+}
+
+struct ReaderResult {
+    std::vector<double> latencies;  // seconds
+    size_t inconsistent = 0;
+};
+
+void runReader(Tree& tree, const Options& options, unsigned id, const std::atomic<bool>& stop, ReaderResult& result) {
+    std::mt19937_64 rng(options.seed + 1 + id);
+    const double side = std::sqrt(options.selectivity);
+    std::vector<Point> found;
+    while (!stop.load(std::memory_order_relaxed)) {
+        Point min = randomPoint(rng);
+        min[0] *= 1 - side;
+        min[1] *= 1 - side;
+        const Point max{{min[0] + side, min[1] + side}};
+        found.clear();
+        const auto start = Clock::now();
+        tree.reportRange(min, max, found);
+        result.latencies.push_back(std::chrono::duration<double>(Clock::now() - start).count());
+        if (options.verify) {
+            found.clear();
+            tree.snapshot().reportRange({{0, 0}}, {{1, 1}}, found);
+            result.inconsistent += found.size() != options.points;
+        }
+    }
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:hn:q:r:s:t:v")) != -1) {
+        switch (opt) {
+        case 'd': options.delta = strtoul(optarg, nullptr, 10); break;
+        case 'n': options.points = strtoul(optarg, nullptr, 10); break;
+        case 'q': options.selectivity = strtod(optarg, nullptr); break;
+        case 'r': options.readers = strtoul(optarg, nullptr, 10); break;
+        case 's': options.seed = strtoul(optarg, nullptr, 10); break;
+        case 't': options.seconds = strtod(optarg, nullptr); break;
+        case 'v': options.verify = true; break;
+        default:
+            printUsage(argv[0]);
+            return opt == 'h' ? 0 : -1;
+        }
+    }
+    if (optind != argc || options.points == 0 || options.delta > options.points) {
+        printUsage(argv[0]);
+        return -1;
+    }
+
+    std::mt19937_64 rng(options.seed);
+    std::vector<Point> live(options.points);
+    for (auto& p : live)
+        p = randomPoint(rng);
+    Tree tree;
+    tree.assign(live);
+
+    std::atomic<bool> stop(false);
+    std::vector<ReaderResult> results(options.readers);
+    std::vector<std::thread> readers;
+    for (unsigned i = 0; i < options.readers; ++i)
+        readers.emplace_back(runReader, std::ref(tree), std::cref(options), i, std::cref(stop), std::ref(results[i]));
+
+    // The writer runs on the main thread.
+    size_t deltas = 0;
+    std::vector<Point> inserts, deletes;
+    const auto start = Clock::now();
+    const auto end = start + std::chrono::duration<double>(options.seconds);
+    Clock::time_point now;
+    while ((now = Clock::now()) < end) {
+        inserts.clear();
+        deletes.clear();
+        for (size_t i = 0; i < options.delta; ++i) {
+            const size_t victim = std::uniform_int_distribution<size_t>(0, live.size() - 1)(rng);
+            deletes.push_back(live[victim]);
+            live[victim] = live.back();
+            live.pop_back();
+        }
+        for (size_t i = 0; i < options.delta; ++i)
+            inserts.push_back(randomPoint(rng));
+        tree.applyDelta(inserts, deletes);
+        live.insert(live.end(), inserts.begin(), inserts.end());
+        ++deltas;
+    }
+    stop = true;
+    for (auto& reader : readers)
+        reader.join();
+    const double elapsed = std::chrono::duration<double>(now - start).count();
+
+    std::vector<double> latencies;
+    size_t inconsistent = 0;
+    for (const auto& result : results) {
+        latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+        inconsistent += result.inconsistent;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    std::cout << std::fixed << std::setprecision(2)
+        << "Writer:  " << deltas << " deltas of " << options.delta << " inserts and deletes, "
+        << deltas / elapsed << " deltas/s, " << 2 * options.delta * deltas / elapsed << " changes/s" << std::endl;
+    for (const auto& metric : tree.metrics())
+        std::cout << "         " << metric.first << " = " << metric.second << std::endl;
+    if (latencies.empty()) {
+        std::cout << "Readers: no queries" << std::endl;
+    } else {
+        std::cout << "Readers: " << options.readers << " threads, " << latencies.size() << " queries, "
+            << latencies.size() / elapsed << " queries/s" << std::endl
+            << "         latency (us): median " << 1e6 * percentile(latencies, 0.5)
+            << ", p99 " << 1e6 * percentile(latencies, 0.99)
+            << ", max " << 1e6 * latencies.back() << std::endl;
+    }
+    if (options.verify) {
+        std::cout << "Snapshots with a wrong number of points: " << inconsistent << std::endl;
+        if (inconsistent)
+            return -3;
+    }
+    return 0;
+}
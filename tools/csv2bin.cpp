@@ -0,0 +1,109 @@
+// Converts CSV points ("x,y") or query windows ("xmin,ymin,xmax,ymax") into
+// the binary format that bench maps with -f and -Q (see framework/binary_file.h).
+// Fields may be separated by commas, semicolons or whitespace. Empty lines,
+// lines starting with '#' and a header line are skipped.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../framework/binary_file.h"
+
+using framework::BinaryFileHeader;
+
+namespace {
+constexpr uint32_t kDimensions = 2;
+
+void printUsage(const char* program_name) {
+    std::cerr << "Usage: " << program_name << " [-q] <input.csv> <output.bin>"
+        "\n  -q  input contains query windows instead of points"
+        << std::endl;
+}
+
+// Parses exactly `count` numbers from a line. Returns false if the line does not
+// consist of numbers only.
+bool parseLine(const std::string& line, size_t count, double* values) {
+    const char* p = line.c_str();
+    for (size_t i = 0; i < count; ++i) {
+        p += strspn(p, " \t,;");
+        char* end;
+        errno = 0;
+        values[i] = strtod(p, &end);
+        if (end == p || errno) return false;
+        p = end;
+    }
+    p += strspn(p, " \t,;\r");
+    return !*p;
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    bool queries = false;
+    int arg = 1;
+    if (arg < argc && !strcmp(argv[arg], "-q")) {
+        queries = true;
+        ++arg;
+    }
+    if (argc - arg != 2) {
+        printUsage(argv[0]);
+        return -1;
+    }
+
+    std::ifstream in(argv[arg]);
+    if (!in) {
+        std::cerr << "Failed to open " << argv[arg] << ": " << strerror(errno) << std::endl;
+        return -2;
+    }
+    std::ofstream out(argv[arg + 1], std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cerr << "Failed to create " << argv[arg + 1] << ": " << strerror(errno) << std::endl;
+        return -2;
+    }
+
+    BinaryFileHeader header;
+    std::copy(std::begin(queries ? framework::kQueriesMagic : framework::kPointsMagic),
+            std::end(queries ? framework::kQueriesMagic : framework::kPointsMagic),
+            std::begin(header.magic));
+    header.dimensions = kDimensions;
+    header.scalar_size = sizeof(double);
+    header.count = 0;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    const size_t values_per_record = queries ? 2 * kDimensions : kDimensions;
+    std::vector<double> values(values_per_record);
+    std::string line;
+    size_t line_number = 0;
+    while (std::getline(in, line)) {
+        ++line_number;
+        if (line.find_first_not_of(" \t\r") == std::string::npos || line[0] == '#')
+            continue;
+        if (!parseLine(line, values_per_record, values.data())) {
+            if (line_number == 1 && !header.count) continue;  // header line
+            std::cerr << argv[arg] << ':' << line_number << ": expected "
+                << values_per_record << " numbers" << std::endl;
+            return -3;
+        }
+        if (queries)
+            for (size_t i = 0; i < kDimensions; ++i)
+                if (values[i] > values[kDimensions + i])
+                    std::swap(values[i], values[kDimensions + i]);
+        out.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(double));
+        ++header.count;
+    }
+
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (!out.flush()) {
+        std::cerr << "Failed to write " << argv[arg + 1] << std::endl;
+        return -2;
+    }
+    std::cout << "Wrote " << header.count << (queries ? " query windows" : " points")
+        << " to " << argv[arg + 1] << std::endl;
+    return 0;
+}
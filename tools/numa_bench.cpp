@@ -0,0 +1,199 @@
+// Measures R+ tree query throughput per NUMA node with query threads on all
+// nodes at once, for one tree bound to the first node and for a tree
+// replicated to every node (ReplicatedRPlusTree). With -H, nodes are backed by
+// huge pages. Reports queries/s and dTLB load misses per query for each node.
+//
+// dTLB misses are read through perf_event_open and reported as n/a where it is
+// not permitted (see /proc/sys/kernel/perf_event_paranoid).
+
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../rplus_numa.h"
+
+using Point = std::array<double, 2>;
+
+namespace {
+struct Options {
+    size_t points = 16384;
+    unsigned threads = 0;
+    double seconds = 2;
+    double selectivity = 0.001;
+    unsigned seed = 0;
+    bool huge_pages = false;
+};
+
+void printUsage(const char* program_name) {
+    std::cerr << "Usage: " << program_name << " [options]"
+        "\n  -n <points>       number of points (default 16384)"
+        "\n  -T <threads>      query threads per NUMA node (default: one per CPU)"
+        "\n  -t <seconds>      duration of each configuration (default 2)"
+        "\n  -q <selectivity>  fraction of the points per query window (default 0.001)"
+        "\n  -s <seed>         random seed (default 0)"
+        "\n  -H                back the tree nodes with huge pages"
+        << std::endl;
+}
+
+/// Counts the calling thread's dTLB load misses, if permitted.
+class DtlbCounter {
+ public:
+    DtlbCounter() {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    ~DtlbCounter() {
+        if (fd_ >= 0)
+            close(fd_);
+    }
+    /// Misses so far, -1 if not available.
+    long long read() const {
+        long long value;
+        return fd_ >= 0 && ::read(fd_, &value, sizeof(value)) == sizeof(value) ? value : -1;
+    }
+
+ private:
+    int fd_;
+};
+
+struct ThreadResult {
+    size_t queries = 0;
+    long long dtlb_misses = 0;
+};
+
+void runQueries(range_search::RangeSearch<Point>& tree, const Options& options, int cpu, unsigned id,
+        const std::atomic<bool>& start, const std::atomic<bool>& stop, ThreadResult& result) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    std::mt19937_64 rng(options.seed + 1 + id);
+    std::uniform_real_distribution<double> unif(0, 1);
+    const double side = std::sqrt(options.selectivity);
+    DtlbCounter counter;
+    while (!start.load(std::memory_order_acquire))
+        std::this_thread::yield();
+    const long long misses = counter.read();
+    while (!stop.load(std::memory_order_relaxed)) {
+        const Point min{{unif(rng) * (1 - side), unif(rng) * (1 - side)}};
+        tree.countRange(min, {{min[0] + side, min[1] + side}});
+        ++result.queries;
+    }
+    result.dtlb_misses = misses < 0 ? -1 : counter.read() - misses;
+}
+
+/// Runs query threads on all nodes at once and prints the throughput per node.
+void measure(const char* name, range_search::RangeSearch<Point>& tree, const Options& options) {
+    const auto& topology = range_search::NumaTopology::Get();
+    std::vector<size_t> node_of_thread;
+    std::vector<int> cpu_of_thread;
+    for (size_t node = 0; node < topology.nodes().size(); ++node) {
+        const auto& cpus = topology.cpus(node);
+        const size_t threads = options.threads ? options.threads : cpus.size();
+        for (size_t i = 0; i < threads && !cpus.empty(); ++i) {
+            node_of_thread.push_back(node);
+            cpu_of_thread.push_back(cpus[i % cpus.size()]);
+        }
+    }
+
+    std::atomic<bool> start(false), stop(false);
+    std::vector<ThreadResult> results(node_of_thread.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < node_of_thread.size(); ++i)
+        threads.emplace_back(runQueries, std::ref(tree), std::cref(options), cpu_of_thread[i], i,
+                std::cref(start), std::cref(stop), std::ref(results[i]));
+    start = true;
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.seconds));
+    stop = true;
+    for (auto& thread : threads)
+        thread.join();
+
+    std::cout << name << ":" << std::endl;
+    for (const auto& metric : tree.metrics())
+        if (metric.first.compare(0, 13, "hugepagebytes") == 0 || metric.first.compare(0, 9, "numabound") == 0
+                || metric.first == "replicas")
+            std::cout << "  " << metric.first << " = " << metric.second << std::endl;
+    for (size_t node = 0; node < topology.nodes().size(); ++node) {
+        size_t queries = 0;
+        long long misses = 0;
+        for (size_t i = 0; i < results.size(); ++i)
+            if (node_of_thread[i] == node) {
+                queries += results[i].queries;
+                misses = misses < 0 || results[i].dtlb_misses < 0 ? -1 : misses + results[i].dtlb_misses;
+            }
+        std::cout << "  node " << topology.nodes()[node] << ": " << queries / options.seconds << " queries/s, dTLB misses/query ";
+        if (misses < 0 || queries == 0)
+            std::cout << "n/a";
+        else
+            std::cout << static_cast<double>(misses) / queries;
+        std::cout << std::endl;
+    }
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    int opt;
+    while ((opt = getopt(argc, argv, "hHn:q:s:t:T:")) != -1) {
+        switch (opt) {
+        case 'H': options.huge_pages = true; break;
+        case 'n': options.points = strtoul(optarg, nullptr, 10); break;
+        case 'q': options.selectivity = strtod(optarg, nullptr); break;
+        case 's': options.seed = strtoul(optarg, nullptr, 10); break;
+        case 't': options.seconds = strtod(optarg, nullptr); break;
+        case 'T': options.threads = strtoul(optarg, nullptr, 10); break;
+        default:
+            printUsage(argv[0]);
+            return opt == 'h' ? 0 : -1;
+        }
+    }
+    if (optind != argc || options.points == 0 || options.seconds <= 0) {
+        printUsage(argv[0]);
+        return -1;
+    }
+
+    std::mt19937_64 rng(options.seed);
+    std::uniform_real_distribution<double> unif(0, 1);
+    std::vector<Point> points(options.points);
+    for (auto& p : points)
+        p = {{unif(rng), unif(rng)}};
+
+    const auto& topology = range_search::NumaTopology::Get();
+    std::cout << std::fixed << std::setprecision(2) << topology.nodes().size() << " NUMA node(s)" << std::endl;
+    {
+        range_search::NodePlacement placement;
+        placement.huge_pages = options.huge_pages;
+        placement.numa_node = topology.nodes()[0];
+        range_search::RPlusTree<Point, 64> tree(placement);
+        tree.assign(points);
+        measure("Single tree on the first node", tree, options);
+    }
+    {
+        range_search::ReplicatedRPlusTree<Point, 64> tree(options.huge_pages);
+        tree.assign(points);
+        measure("Replica per node", tree, options);
+    }
+    return 0;
+}
@@ -0,0 +1,203 @@
+// Load generator for range_server: runs 1, 2, 4, ... clients, each on its own
+// connection and thread, that keep a fixed number of requests in flight, and
+// reports the throughput and the latency percentiles per number of clients.
+//
+// Queries are windows (or kNN centers) spread uniformly over the unit square,
+// the extent of the points range_server generates.
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../query_protocol.h"
+
+using range_search::QueryRequest;
+using range_search::QueryResponse;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+struct Options {
+    range_search::ServerAddress address;
+    unsigned clients = 16;
+    size_t depth = 8;
+    double seconds = 2;
+    std::string op = "count";
+    double selectivity = 0.001;
+    unsigned k = 10;
+    unsigned seed = 0;
+};
+
+void printUsage(const char* program_name) {
+    std::cerr << "Usage: " << program_name << " [options]"
+        "\n  -u <path>         connect to this Unix socket (default /tmp/range_server.sock)"
+        "\n  -p <port>         connect to this TCP port of the loopback interface instead"
+        "\n  -c <clients>      largest number of clients (default 16)"
+        "\n  -d <requests>     requests in flight per client (default 8)"
+        "\n  -t <seconds>      duration per number of clients (default 2)"
+        "\n  -o <op>           count, report, nearest or mixed (default count)"
+        "\n  -q <selectivity>  fraction of the unit square per query window (default 0.001)"
+        "\n  -k <neighbours>   neighbours per nearest query (default 10)"
+        "\n  -s <seed>         random seed (default 0)"
+        << std::endl;
+}
+
+struct ClientResult {
+    std::vector<double> latencies;  // seconds
+    size_t points = 0;
+    size_t errors = 0;
+};
+
+QueryRequest randomRequest(const Options& options, std::mt19937_64& rng, uint64_t id) {
+    std::uniform_real_distribution<double> unif(0, 1);
+    const double side = std::sqrt(options.selectivity);
+    QueryRequest request;
+    if (options.op == "count")
+        request.op = QueryRequest::kCount;
+    else if (options.op == "report")
+        request.op = QueryRequest::kReport;
+    else if (options.op == "nearest")
+        request.op = QueryRequest::kNearest;
+    else
+        request.op = QueryRequest::kCount + rng() % 3;
+    request.k = options.k;
+    request.id = id;
+    request.min[0] = unif(rng) * (1 - side);
+    request.min[1] = unif(rng) * (1 - side);
+    request.max[0] = request.min[0] + side;
+    request.max[1] = request.min[1] + side;
+    return request;
+}
+
+/// Keeps options.depth requests in flight until stop, then collects the
+/// outstanding responses without recording them.
+void runClient(const Options& options, unsigned id, const std::atomic<bool>& stop, ClientResult& result) {
+    const int fd = range_search::Connect(options.address);
+    std::mt19937_64 rng(options.seed + 1 + id);
+    std::unordered_map<uint64_t, Clock::time_point> in_flight;
+    std::vector<QueryRequest> requests;
+    std::vector<char> points;
+    uint64_t next_id = 0;
+    for (;;) {
+        const bool stopping = stop.load(std::memory_order_relaxed);
+        if (!stopping) {
+            requests.clear();
+            const auto now = Clock::now();
+            while (in_flight.size() < options.depth) {
+                requests.push_back(randomRequest(options, rng, next_id));
+                in_flight.emplace(next_id++, now);
+            }
+            range_search::SendAll(fd, requests.data(), requests.size() * sizeof(QueryRequest));
+        }
+        if (in_flight.empty())
+            break;
+        QueryResponse response;
+        if (!range_search::ReceiveAll(fd, &response, sizeof(response)))
+            throw std::runtime_error("server closed the connection");
+        points.resize(response.num_points * 2 * sizeof(double));
+        if (!points.empty() && !range_search::ReceiveAll(fd, points.data(), points.size()))
+            throw std::runtime_error("server closed the connection");
+        if (!(response.flags & QueryResponse::kLast))
+            continue;
+        const auto sent = in_flight.find(response.id);
+        if (sent == in_flight.end())
+            throw std::runtime_error("response to unknown request " + std::to_string(response.id));
+        if (!stopping) {
+            result.latencies.push_back(std::chrono::duration<double>(Clock::now() - sent->second).count());
+            result.points += response.count;
+            result.errors += (response.flags & QueryResponse::kError) != 0;
+        }
+        in_flight.erase(sent);
+    }
+    close(fd);
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    options.address.socket_path = "/tmp/range_server.sock";
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:hk:o:p:q:s:t:u:")) != -1) {
+        switch (opt) {
+        case 'c': options.clients = strtoul(optarg, nullptr, 10); break;
+        case 'd': options.depth = strtoul(optarg, nullptr, 10); break;
+        case 'k': options.k = strtoul(optarg, nullptr, 10); break;
+        case 'o': options.op = optarg; break;
+        case 'p': options.address.port = atoi(optarg); break;
+        case 'q': options.selectivity = strtod(optarg, nullptr); break;
+        case 's': options.seed = strtoul(optarg, nullptr, 10); break;
+        case 't': options.seconds = strtod(optarg, nullptr); break;
+        case 'u': options.address.socket_path = optarg; break;
+        default:
+            printUsage(argv[0]);
+            return opt == 'h' ? 0 : -1;
+        }
+    }
+    if (optind != argc || options.clients == 0 || options.depth == 0 || options.seconds <= 0
+            || (options.op != "count" && options.op != "report" && options.op != "nearest" && options.op != "mixed")) {
+        printUsage(argv[0]);
+        return -1;
+    }
+
+    std::cout << std::fixed << std::setprecision(2);
+    for (unsigned clients = 1; clients <= options.clients; clients *= 2) {
+        std::atomic<bool> stop(false), failed(false);
+        std::vector<ClientResult> results(clients);
+        std::vector<std::thread> threads;
+        const auto start = Clock::now();
+        for (unsigned i = 0; i < clients; ++i) {
+            threads.emplace_back([&, i]() {
+                try {
+                    runClient(options, i, stop, results[i]);
+                } catch (const std::exception& e) {
+                    std::cerr << "Client " << i << ": " << e.what() << std::endl;
+                    failed = true;
+                }
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::duration<double>(options.seconds));
+        stop = true;
+        const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        for (auto& thread : threads)
+            thread.join();
+        if (failed)
+            return -1;
+
+        std::vector<double> latencies;
+        size_t points = 0, errors = 0;
+        for (const auto& result : results) {
+            latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+            points += result.points;
+            errors += result.errors;
+        }
+        std::sort(latencies.begin(), latencies.end());
+        std::cout << std::setw(3) << clients << " clients: ";
+        if (latencies.empty()) {
+            std::cout << "no responses" << std::endl;
+            continue;
+        }
+        std::cout << latencies.size() / elapsed << " requests/s, "
+            << static_cast<double>(points) / latencies.size() << " points/request, latency (us): median "
+            << 1e6 * percentile(latencies, 0.5) << ", p90 " << 1e6 * percentile(latencies, 0.9)
+            << ", p99 " << 1e6 * percentile(latencies, 0.99) << ", p99.9 " << 1e6 * percentile(latencies, 0.999)
+            << ", max " << 1e6 * latencies.back();
+        if (errors)
+            std::cout << ", " << errors << " errors";
+        std::cout << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,343 @@
+// Serves count, report and k-nearest-neighbour queries on an R+ tree over a
+// Unix socket or a loopback TCP port, using the protocol of query_protocol.h.
+//
+// The points are memory-mapped from a binary file written by csv2bin (-f) or
+// generated uniformly in the unit square, and indexed once at startup. Every
+// connection has a thread reading its pipelined requests into one queue;
+// worker threads take whatever has queued up, up to the batch size, and answer
+// the count and report queries of a batch as one interleaved batch query
+// (RPlusTree::countRanges / reportRanges). Results larger than the chunk size
+// are sent as several responses.
+
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "../framework/binary_file.h"
+#include "../query_protocol.h"
+#include "../rplus.h"
+
+using Point = std::array<double, 2>;
+using Tree = range_search::RPlusTree<Point, 64>;
+using range_search::QueryRequest;
+using range_search::QueryResponse;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+struct Options {
+    range_search::ServerAddress address;
+    std::string points_file;
+    size_t points = 65536;
+    unsigned seed = 0;
+    size_t batch = 64;
+    size_t chunk = 4096;
+    unsigned workers = 0;
+};
+
+void printUsage(const char* program_name) {
+    std::cerr << "Usage: " << program_name << " [options]"
+        "\n  -u <path>         listen on this Unix socket (default /tmp/range_server.sock)"
+        "\n  -p <port>         listen on this TCP port of the loopback interface instead"
+        "\n  -f <points.bin>   serve the points of this file (see csv2bin)"
+        "\n  -n <points>       otherwise, serve this many random points in the unit square (default 65536)"
+        "\n  -s <seed>         random seed (default 0)"
+        "\n  -b <requests>     largest batch of requests answered together (default 64)"
+        "\n  -c <points>       largest number of points per response (default 4096)"
+        "\n  -w <threads>      worker threads (default: one per CPU)"
+        << std::endl;
+}
+
+struct Connection {
+    explicit Connection(int fd) : fd(fd), broken(false) {}
+    ~Connection() { close(fd); }
+
+    const int fd;
+    /// Held while sending, so that the responses to one request stay together.
+    std::mutex send_mutex;
+    std::atomic<bool> broken;
+};
+
+struct Pending {
+    std::shared_ptr<Connection> connection;
+    QueryRequest request;
+};
+
+class Server {
+ public:
+    Server(Tree& tree, const Options& options) : tree_(tree), options_(options) {}
+
+    /// Queues the requests arriving on connection until the client closes it.
+    void readRequests(std::shared_ptr<Connection> connection) {
+        ++connections_;
+        std::vector<char> buffer(options_.batch * sizeof(QueryRequest));
+        size_t filled = 0;
+        for (;;) {
+            const ssize_t received = recv(connection->fd, buffer.data() + filled, buffer.size() - filled, 0);
+            if (received < 0 && errno == EINTR)
+                continue;
+            if (received <= 0)
+                break;
+            filled += received;
+            const size_t whole = filled / sizeof(QueryRequest);
+            if (whole > 0) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    for (size_t i = 0; i < whole; ++i) {
+                        pending_.push_back({connection, QueryRequest()});
+                        memcpy(&pending_.back().request, buffer.data() + i * sizeof(QueryRequest), sizeof(QueryRequest));
+                    }
+                }
+                if (whole > 1)
+                    queued_.notify_all();
+                else
+                    queued_.notify_one();
+                filled -= whole * sizeof(QueryRequest);
+                memmove(buffer.data(), buffer.data() + whole * sizeof(QueryRequest), filled);
+            }
+        }
+        if (--connections_ == 0) {
+            const size_t batches = batches_.exchange(0), requests = requests_.exchange(0);
+            std::cerr << "All clients gone: answered " << requests << " requests in " << batches << " batches";
+            if (batches > 0)
+                std::cerr << ", " << static_cast<double>(requests) / batches << " requests per batch";
+            std::cerr << std::endl;
+        }
+    }
+
+    /// Answers batches of queued requests, forever.
+    void serveBatches() {
+        std::vector<Pending> batch;
+        for (;;) {
+            batch.clear();
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                queued_.wait(lock, [this]() { return !pending_.empty(); });
+                while (!pending_.empty() && batch.size() < options_.batch) {
+                    batch.push_back(std::move(pending_.front()));
+                    pending_.pop_front();
+                }
+            }
+            answer(batch);
+            ++batches_;
+            requests_ += batch.size();
+        }
+    }
+
+ private:
+    /// Pending responses to one connection.
+    struct Outbox {
+        Connection* connection;
+        std::vector<char> bytes;
+    };
+
+    void answer(const std::vector<Pending>& batch) {
+        // Count and report queries each go to the tree as one batch.
+        std::vector<std::pair<Point, Point>> count_windows, report_windows;
+        std::vector<size_t> slot(batch.size());
+        for (size_t i = 0; i < batch.size(); ++i) {
+            const QueryRequest& request = batch[i].request;
+            const std::pair<Point, Point> window{{{request.min[0], request.min[1]}}, {{request.max[0], request.max[1]}}};
+            if (request.op == QueryRequest::kCount) {
+                slot[i] = count_windows.size();
+                count_windows.push_back(window);
+            } else if (request.op == QueryRequest::kReport) {
+                slot[i] = report_windows.size();
+                report_windows.push_back(window);
+            }
+        }
+        std::vector<size_t> counts(count_windows.size());
+        std::vector<std::vector<Point>> reports(report_windows.size());
+        tree_.countRanges(count_windows.data(), count_windows.size(), counts.data());
+        tree_.reportRanges(report_windows.data(), report_windows.size(), reports.data());
+
+        std::vector<Outbox> outboxes;
+        std::vector<Point> nearest;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            const QueryRequest& request = batch[i].request;
+            Connection* connection = batch[i].connection.get();
+            if (connection->broken)
+                continue;
+            auto outbox = std::find_if(outboxes.begin(), outboxes.end(),
+                    [connection](const Outbox& o) { return o.connection == connection; });
+            if (outbox == outboxes.end()) {
+                outboxes.push_back({connection, {}});
+                outbox = outboxes.end() - 1;
+            }
+            QueryResponse response = {request.id, QueryResponse::kLast, 0, 0};
+            const std::vector<Point>* points = nullptr;
+            switch (request.op) {
+            case QueryRequest::kCount:
+                response.count = counts[slot[i]];
+                break;
+            case QueryRequest::kReport:
+                points = &reports[slot[i]];
+                break;
+            case QueryRequest::kNearest:
+                nearest.clear();
+                tree_.reportNearest({{request.min[0], request.min[1]}}, request.k, nearest);
+                points = &nearest;
+                break;
+            default:
+                response.flags |= QueryResponse::kError;
+            }
+            if (points)
+                response.count = points->size();
+            if (!points || points->size() <= options_.chunk) {
+                if (points)
+                    response.num_points = points->size();
+                append(outbox->bytes, response, points ? points->data() : nullptr);
+            } else {
+                stream(*outbox, response, *points);
+            }
+        }
+        for (auto& outbox : outboxes)
+            flush(outbox);
+    }
+
+    static void append(std::vector<char>& bytes, const QueryResponse& response, const Point* points) {
+        const char* header = reinterpret_cast<const char*>(&response);
+        bytes.insert(bytes.end(), header, header + sizeof(response));
+        const char* data = reinterpret_cast<const char*>(points);
+        bytes.insert(bytes.end(), data, data + response.num_points * sizeof(Point));
+    }
+
+    /// Sends points in chunks, after the responses queued for the same connection.
+    void stream(Outbox& outbox, QueryResponse response, const std::vector<Point>& points) {
+        std::lock_guard<std::mutex> lock(outbox.connection->send_mutex);
+        try {
+            range_search::SendAll(outbox.connection->fd, outbox.bytes.data(), outbox.bytes.size());
+            outbox.bytes.clear();
+            for (size_t first = 0; first < points.size(); first += options_.chunk) {
+                response.num_points = std::min(options_.chunk, points.size() - first);
+                response.flags = first + response.num_points == points.size() ? static_cast<uint32_t>(QueryResponse::kLast) : 0;
+                range_search::SendAll(outbox.connection->fd, &response, sizeof(response));
+                range_search::SendAll(outbox.connection->fd, &points[first], response.num_points * sizeof(Point));
+            }
+        } catch (const std::runtime_error&) {
+            disconnect(*outbox.connection);
+        }
+    }
+
+    void flush(Outbox& outbox) {
+        if (outbox.bytes.empty() || outbox.connection->broken)
+            return;
+        std::lock_guard<std::mutex> lock(outbox.connection->send_mutex);
+        try {
+            range_search::SendAll(outbox.connection->fd, outbox.bytes.data(), outbox.bytes.size());
+        } catch (const std::runtime_error&) {
+            disconnect(*outbox.connection);
+        }
+    }
+
+    /// Drops a client that cannot be sent to; its reader thread sees the end of the connection.
+    static void disconnect(Connection& connection) {
+        connection.broken = true;
+        shutdown(connection.fd, SHUT_RDWR);
+    }
+
+    Tree& tree_;
+    const Options& options_;
+    std::mutex mutex_;
+    std::condition_variable queued_;
+    std::deque<Pending> pending_;
+    std::atomic<size_t> connections_{0};
+    std::atomic<size_t> batches_{0};
+    std::atomic<size_t> requests_{0};
+};
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    options.address.socket_path = "/tmp/range_server.sock";
+    int opt;
+    while ((opt = getopt(argc, argv, "b:c:f:hn:p:s:u:w:")) != -1) {
+        switch (opt) {
+        case 'b': options.batch = strtoul(optarg, nullptr, 10); break;
+        case 'c': options.chunk = strtoul(optarg, nullptr, 10); break;
+        case 'f': options.points_file = optarg; break;
+        case 'n': options.points = strtoul(optarg, nullptr, 10); break;
+        case 'p': options.address.port = atoi(optarg); break;
+        case 's': options.seed = strtoul(optarg, nullptr, 10); break;
+        case 'u': options.address.socket_path = optarg; break;
+        case 'w': options.workers = strtoul(optarg, nullptr, 10); break;
+        default:
+            printUsage(argv[0]);
+            return opt == 'h' ? 0 : -1;
+        }
+    }
+    if (optind != argc || options.batch == 0 || options.chunk == 0) {
+        printUsage(argv[0]);
+        return -1;
+    }
+    if (options.workers == 0)
+        options.workers = std::max(1u, std::thread::hardware_concurrency());
+
+    Tree tree;
+    try {
+        const auto start = Clock::now();
+        framework::Records<Point> points;
+        if (options.points_file.empty()) {
+            std::mt19937_64 rng(options.seed);
+            std::uniform_real_distribution<double> unif(0, 1);
+            std::vector<Point> generated(options.points);
+            for (auto& p : generated)
+                p = {{unif(rng), unif(rng)}};
+            points = framework::Records<Point>(std::move(generated));
+        } else {
+            points = framework::Records<Point>::map(options.points_file, framework::kPointsMagic, 1);
+        }
+        tree.assign(points.begin(), points.end());
+        std::cerr << "Indexed " << points.size() << " points in "
+            << std::chrono::duration<double>(Clock::now() - start).count() << " s" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    int listener;
+    try {
+        listener = range_search::Listen(options.address);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+    if (options.address.port)
+        std::cerr << "Listening on 127.0.0.1:" << options.address.port << std::endl;
+    else
+        std::cerr << "Listening on " << options.address.socket_path << std::endl;
+
+    Server server(tree, options);
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < options.workers; ++i)
+        workers.emplace_back(&Server::serveBatches, &server);
+    for (;;) {
+        const int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            std::cerr << "accept: " << strerror(errno) << std::endl;
+            return -1;
+        }
+        if (options.address.port) {
+            const int yes = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        }
+        std::thread(&Server::readRequests, &server, std::make_shared<Connection>(fd)).detach();
+    }
+}
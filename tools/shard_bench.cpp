@@ -0,0 +1,144 @@
+// Measures the overhead of routing queries through ShardedRangeSearch: runs the
+// same range queries against one R+ tree and against 1, 2, 4, ... shards, with
+// the shards in this process and in forked processes (RemoteShard), and reports
+// the mean latency, the mean number of shards per query and the latency added
+// per query compared to the single tree. Shard servers listening on the socket
+// paths given as arguments (see tools/shard_server.cpp) are measured as well.
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../remote_shard.h"
+#include "../rplus.h"
+#include "../sharded.h"
+
+using Point = std::array<double, 2>;
+using Tree = range_search::RPlusTree<Point, 64>;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+struct Options {
+    size_t points = 65536;
+    size_t queries = 10000;
+    size_t max_shards = 16;
+    double selectivity = 0.001;
+    unsigned seed = 0;
+    bool reporting = false;
+};
+
+void printUsage(const char* program_name) {
+    std::cerr << "Usage: " << program_name << " [options] [shard server socket paths]"
+        "\n  -n <points>       number of points (default 65536)"
+        "\n  -Q <queries>      number of queries per configuration (default 10000)"
+        "\n  -k <shards>       largest number of shards (default 16)"
+        "\n  -q <selectivity>  fraction of the points per query window (default 0.001)"
+        "\n  -s <seed>         random seed (default 0)"
+        "\n  -r                report the points instead of counting them"
+        << std::endl;
+}
+
+/// Runs the queries and returns the mean latency in microseconds.
+double measure(range_search::RangeSearch<Point>& index, const std::vector<std::pair<Point, Point>>& queries,
+        bool reporting, size_t& checksum) {
+    std::vector<Point> result;
+    checksum = 0;
+    const auto start = Clock::now();
+    for (const auto& query : queries) {
+        if (reporting) {
+            result.clear();
+            index.reportRange(query.first, query.second, result);
+            checksum += result.size();
+        } else {
+            checksum += index.countRange(query.first, query.second);
+        }
+    }
+    return std::chrono::duration<double, std::micro>(Clock::now() - start).count() / queries.size();
+}
+
+double fanout(const range_search::RangeSearch<Point>& index) {
+    for (const auto& metric : index.metrics())
+        if (metric.first == "fanout")
+            return metric.second;
+    return 1;
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    int opt;
+    while ((opt = getopt(argc, argv, "hk:n:q:Q:rs:")) != -1) {
+        switch (opt) {
+        case 'k': options.max_shards = strtoul(optarg, nullptr, 10); break;
+        case 'n': options.points = strtoul(optarg, nullptr, 10); break;
+        case 'q': options.selectivity = strtod(optarg, nullptr); break;
+        case 'Q': options.queries = strtoul(optarg, nullptr, 10); break;
+        case 'r': options.reporting = true; break;
+        case 's': options.seed = strtoul(optarg, nullptr, 10); break;
+        default:
+            printUsage(argv[0]);
+            return opt == 'h' ? 0 : -1;
+        }
+    }
+    if (options.points == 0 || options.queries == 0 || options.max_shards == 0) {
+        printUsage(argv[0]);
+        return -1;
+    }
+    const std::vector<std::string> servers(argv + optind, argv + argc);
+
+    std::mt19937_64 rng(options.seed);
+    std::uniform_real_distribution<double> unif(0, 1);
+    std::vector<Point> points(options.points);
+    for (auto& p : points)
+        p = {{unif(rng), unif(rng)}};
+    const double side = std::sqrt(options.selectivity);
+    std::vector<std::pair<Point, Point>> queries(options.queries);
+    for (auto& query : queries) {
+        query.first = {{unif(rng) * (1 - side), unif(rng) * (1 - side)}};
+        query.second = {{query.first[0] + side, query.first[1] + side}};
+    }
+
+    size_t expected;
+    double baseline;
+    {
+        Tree tree;
+        tree.assign(points);
+        baseline = measure(tree, queries, options.reporting, expected);
+    }
+    std::cout << std::fixed << std::setprecision(2) << "R+Tree64: " << baseline << " us/query" << std::endl;
+
+    auto run = [&](const std::string& name, range_search::ShardedRangeSearch<Point>& index) {
+        index.assign(points);
+        size_t checksum;
+        const double latency = measure(index, queries, options.reporting, checksum);
+        std::cout << name << ": " << latency << " us/query, " << fanout(index) << " shards/query, "
+            << latency - baseline << " us/query overhead";
+        if (checksum != expected)
+            std::cout << " (wrong results: " << checksum << " points instead of " << expected << ")";
+        std::cout << std::endl;
+    };
+    for (size_t shards = 1; shards <= options.max_shards; shards *= 2) {
+        range_search::ShardedRangeSearch<Point> local(shards, []() { return new Tree; });
+        run(std::to_string(shards) + " local shard(s)", local);
+    }
+    for (size_t shards = 1; shards <= options.max_shards; shards *= 2) {
+        range_search::ShardedRangeSearch<Point> remote(shards, []() { return new range_search::RemoteShard<Point, Tree>; });
+        run(std::to_string(shards) + " forked shard(s)", remote);
+    }
+    if (!servers.empty()) {
+        size_t next = 0;
+        range_search::ShardedRangeSearch<Point> served(servers.size(), [&]() {
+            return new range_search::RemoteShard<Point, Tree>(servers[next++]);
+        });
+        run(std::to_string(servers.size()) + " shard server(s)", served);
+    }
+    return 0;
+}
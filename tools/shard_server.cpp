@@ -0,0 +1,56 @@
+// Serves one shard of a ShardedRangeSearch from a separate process: listens on
+// a Unix socket and answers the requests of every RemoteShard connecting to it
+// (see remote_shard.h), one connection after the other, with an R+ tree that is
+// rebuilt on every assign.
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <array>
+#include <iostream>
+#include <stdexcept>
+
+#include "../remote_shard.h"
+#include "../rplus.h"
+
+using Point = std::array<double, 2>;
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        std::cerr << "Usage: " << argv[0] << " <socket path>" << std::endl;
+        return -1;
+    }
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(argv[1]) >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path too long: " << argv[1] << std::endl;
+        return -1;
+    }
+    strcpy(address.sun_path, argv[1]);
+    unlink(argv[1]);
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0
+            || listen(listener, 1) != 0) {
+        std::cerr << "Cannot listen on " << argv[1] << ": " << strerror(errno) << std::endl;
+        return -1;
+    }
+    for (;;) {
+        const int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "accept: " << strerror(errno) << std::endl;
+            return -1;
+        }
+        try {
+            range_search::ServeShard<Point, range_search::RPlusTree<Point, 64>>(fd);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+        }
+        close(fd);
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef RANGE_SEARCH_TRAVERSAL_STATS_H_
+#define RANGE_SEARCH_TRAVERSAL_STATS_H_
+
+#include <algorithm>
+#include <cstddef>
+
+// Optional counters describing how queries traverse a data structure. They are
+// only compiled in if RANGE_SEARCH_TRAVERSAL_STATS is defined (make
+// TRAVERSAL_STATS=1); otherwise TRAVERSAL_STAT(...) expands to nothing.
+#ifdef RANGE_SEARCH_TRAVERSAL_STATS
+#define TRAVERSAL_STAT(...) __VA_ARGS__
+#else
+#define TRAVERSAL_STAT(...)
+#endif
+
+namespace range_search {
+
+struct TraversalStats {
+    static constexpr size_t kMaxLevels = 32;
+#ifdef RANGE_SEARCH_TRAVERSAL_STATS
+    static constexpr bool kEnabled = true;
+#else
+    static constexpr bool kEnabled = false;
+#endif
+
+    /// Nodes visited per level, level 0 being the root.
+    size_t nodes_visited[kMaxLevels];
+    /// Entries whose bounding box was tested against the query.
+    size_t entries_tested;
+    /// Subtrees that were descended into but did not contain a single result.
+    size_t empty_subtrees;
+    /// Points reported or counted.
+    size_t points_reported;
+    /// Current depth of the traversal.
+    size_t depth;
+
+    void reset() {
+        std::fill(std::begin(nodes_visited), std::end(nodes_visited), 0);
+        entries_tested = empty_subtrees = points_reported = depth = 0;
+    }
+
+    /// Marks a node as visited for its lifetime and tracks the traversal depth.
+    class NodeVisit {
+     public:
+        NodeVisit() {
+            auto& stats = get();
+            ++stats.nodes_visited[std::min(stats.depth, kMaxLevels - 1)];
+            ++stats.depth;
+        }
+        ~NodeVisit() { --get().depth; }
+    };
+
+    static TraversalStats& get() {
+        static TraversalStats stats = init();
+        return stats;
+    }
+
+ private:
+    static TraversalStats init() {
+        TraversalStats stats;
+        stats.reset();
+        return stats;
+    }
+};
+
+}  // namespace range_search
+#endif  // RANGE_SEARCH_TRAVERSAL_STATS_H_